@@ -0,0 +1,35 @@
+/*
+    Tracking of the heap allocations made by the tested function calls.
+*/
+
+#pragma once
+
+#include <cstddef>
+
+namespace gcheck {
+
+// Heap allocations made while the tracker was recording
+struct AllocationStats {
+    size_t allocations = 0;
+    size_t bytes = 0; // Total bytes requested
+    size_t peak_bytes = 0; // Peak of the bytes allocated while recording and not yet freed
+    size_t leaked_blocks = 0; // Blocks allocated while recording that weren't freed before Stop
+    size_t leaked_bytes = 0;
+};
+
+/*
+    Global operator new and delete are replaced, and on glibc malloc and friends too, with versions that
+    record the allocations when the tracker is on. When it's off they only check a flag.
+    The tracker is process wide, so only one recording can be going on at a time.
+*/
+class AllocationTracker {
+public:
+    // Clears the previous results and starts recording allocations
+    static void Start();
+    // Stops recording new allocations. Frees of the recorded blocks are still tracked until Stop.
+    static void Pause();
+    // Stops tracking and returns the results
+    static AllocationStats Stop();
+};
+
+} // gcheck
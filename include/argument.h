@@ -6,6 +6,12 @@
 #include <tuple>
 #include <variant>
 #include <algorithm>
+#include <vector>
+#include <array>
+#include <utility>
+#include <stdexcept>
+
+#include "random.h"
 
 namespace gcheck {
 /*
@@ -55,6 +61,23 @@ public:
     virtual T& Next() = 0;
     virtual NextType<T>* Clone() const = 0;
     virtual ~NextType() {}
+
+    // Writes the next 'count' values to 'out', the same values that many calls of Next would give
+    virtual void Fill(T* out, size_t count) {
+        if constexpr(std::is_copy_assignable_v<T>) {
+            for(size_t i = 0; i < count; i++)
+                out[i] = Next();
+        } else {
+            (void)out;
+            if(count)
+                throw std::runtime_error("Fill needs copy assignable values");
+        }
+    }
+    std::vector<T> NextBatch(size_t count) {
+        std::vector<T> values(count);
+        Fill(values.data(), count);
+        return values;
+    }
 };
 
 template<typename T>
@@ -66,17 +89,23 @@ struct Discrete : public NextType<T> {
     virtual size_t ChoiceLength() = 0;
 };
 
-// Base class for the different distributions
+// Base class for the different distributions. The values are drawn from a RandomStream keyed by --seed and the run
+// unless a seed other than UINT32_MAX is given.
 template<typename A>
 class Distribution {
 protected:
-    std::default_random_engine generator_;
+    RandomStream generator_;
 public:
-    Distribution() : generator_(std::random_device()()) {}
-    Distribution(uint32_t seed) : generator_(seed == UINT32_MAX ? std::random_device()() : seed) {}
+    Distribution() {}
+    Distribution(uint32_t seed) : generator_(seed == UINT32_MAX ? RandomStream() : RandomStream(seed)) {}
 
     //virtual Distribution Clone() = 0;
     virtual A operator()() = 0;
+    // The same values as 'count' calls of operator()
+    virtual void Fill(A* out, size_t count) {
+        for(size_t i = 0; i < count; i++)
+            out[i] = (*this)();
+    }
 };
 
 // A class that randomly selects an item from a std::vector
@@ -101,17 +130,47 @@ class RangeDistribution<A, typename std::enable_if<std::is_floating_point<A>::va
 public:
 
     RangeDistribution(const A& start = std::numeric_limits<A>::min(), const A& end = std::numeric_limits<A>::max(), uint32_t seed = UINT32_MAX)
-        : Distribution<A>(seed), start_(start), end_(end), distribution_(start, end) {}
-    RangeDistribution(const RangeDistribution<A>& dist) : Distribution<A>(dist), start_(dist.start_), end_(dist.end_), distribution_(dist.distribution_) {}
-    A operator()() { return distribution_(Distribution<A>::generator_); }
+        : Distribution<A>(seed), start_(start), end_(end) {}
+    A operator()() {
+        uint64_t bits = Distribution<A>::generator_();
+        A value;
+        Map(&bits, &value, 1);
+        return value;
+    }
+    // The engine and the mapping run in batches without virtual calls
+    void Fill(A* out, size_t count) override {
+        uint64_t bits[256];
+        for(size_t done = 0; done < count;) {
+            size_t n = std::min(count - done, sizeof(bits)/sizeof(bits[0]));
+            Distribution<A>::generator_.Fill(bits, n);
+            Map(bits, out + done, n);
+            done += n;
+        }
+    }
 private:
+    /*
+        Integers are [start, end], taken from the high bits of bits*(end - start + 1), which is biased by at most
+        (end - start + 1)/2^64. Floating point values are [start, end) with 53 random bits. The full range is checked
+        once for all the values, so the loops only multiply and add.
+    */
+    void Map(const uint64_t* bits, A* out, size_t count) const {
+        if constexpr(std::is_integral<A>::value) {
+            uint64_t range = (uint64_t)end_ - (uint64_t)start_ + 1;
+            if(range == 0) { // The full 64 bit range
+                for(size_t i = 0; i < count; i++)
+                    out[i] = (A)bits[i];
+            } else {
+                for(size_t i = 0; i < count; i++)
+                    out[i] = (A)((uint64_t)start_ + MultiplyHigh(bits[i], range));
+            }
+        } else {
+            for(size_t i = 0; i < count; i++)
+                out[i] = start_ + (end_ - start_)*(A)((bits[i] >> 11)*0x1.0p-53);
+        }
+    }
+
     A start_;
     A end_;
-    // Use int distribution for integral types and real distribution for floating point types
-    typename std::conditional<std::is_integral<A>::value,
-        std::uniform_int_distribution<A>,
-        std::uniform_real_distribution<A>
-        >::type distribution_;
 };
 
 // Specialization of RangeDistribution for values not floating point nor integral
@@ -179,6 +238,11 @@ public:
     Random(const Random<A>& rnd) : Argument<A>(rnd()), distribution_(rnd.distribution_) {}
 
     A& Next() { return this->value_ = (*distribution_)(); };
+    void Fill(A* out, size_t count) override {
+        distribution_->Fill(out, count);
+        if(count)
+            this->value_ = out[count-1];
+    }
     NextType<A>* Clone() const {
         return new Random(*this);
     }
@@ -259,6 +323,13 @@ public:
     }
     ReturnType& Next() {
         this->value_.resize(size_->Next(), default_);
+        // A single source fills a vector in one call
+        if constexpr(std::is_same_v<ReturnType, std::vector<T>> && !std::is_same_v<T, bool>) {
+            if(source_.size() == 1) {
+                source_[0]->Fill(this->value_.data(), this->value_.size());
+                return this->value_;
+            }
+        }
         auto it2 = source_.begin();
         if(it2 != source_.end()) {
             for(auto it = this->value_.begin(); it != this->value_.end(); ++it, ++it2) {
@@ -397,33 +468,108 @@ enum CombineType {
     WeightedCombine
 };
 
+// The type of the values of a Combine: the type of the values of the parts if they're the same, otherwise a variant
+template<typename Tuple>
+struct combine_value;
+template<typename T, typename... Ts>
+struct combine_value<std::tuple<T, Ts...>> {
+    typedef std::conditional_t<are_same<T, Ts...>::value, T, std::variant<T, Ts...>> type;
+};
+
 template<typename... Args>
 class CombineBase {
     //static_assert(sizeof...(Args) != 0, "Combine must have at least one item in it");s
     typedef typename get_templates<NextType, Args...>::types_tuple TypesTuple;
-    typedef std::conditional<are_same<Args>::value..., std::tuple_element<0, std::tuple<Args...>>::type, std::variant<Args...>> ReturnType;
 protected:
+    typedef typename combine_value<TypesTuple>::type ReturnType;
+    static constexpr size_t num_parts = sizeof...(Args);
+
     CombineBase(const Args&... args) : parts_(args...) {}
 
+    /*
+        Builds the alias table for choosing the parts with probabilities proportional to 'weights' (Vose's alias
+        method). Slot i is chosen with a uniform index, and then it's part i with probability probability_[i],
+        otherwise part alias_[i].
+    */
+    void BuildTable(const std::array<double, num_parts>& weights) {
+        double total = 0;
+        for(double weight : weights)
+            total += weight;
+
+        std::array<double, num_parts> scaled;
+        std::array<size_t, num_parts> small, large;
+        size_t num_small = 0, num_large = 0;
+        for(size_t i = 0; i < num_parts; i++) {
+            scaled[i] = total > 0 ? weights[i]*num_parts/total : 1.0;
+            if(scaled[i] < 1.0)
+                small[num_small++] = i;
+            else
+                large[num_large++] = i;
+        }
+        while(num_small != 0 && num_large != 0) {
+            size_t less = small[--num_small];
+            size_t more = large[--num_large];
+            probability_[less] = scaled[less];
+            alias_[less] = more;
+            scaled[more] -= 1.0 - scaled[less];
+            if(scaled[more] < 1.0)
+                small[num_small++] = more;
+            else
+                large[num_large++] = more;
+        }
+        // What's left is 1 up to rounding errors
+        while(num_large != 0) {
+            size_t i = large[--num_large];
+            probability_[i] = 1.0;
+            alias_[i] = i;
+        }
+        while(num_small != 0) {
+            size_t i = small[--num_small];
+            probability_[i] = 1.0;
+            alias_[i] = i;
+        }
+    }
+
+    // Chooses a part with the alias table and takes the next value of only that part
+    ReturnType& NextValue() {
+        double slot = rnd_()*num_parts;
+        size_t index = std::min((size_t)slot, num_parts - 1);
+        if(slot - index >= probability_[index])
+            index = alias_[index];
+        NextOf(index, std::index_sequence_for<Args...>());
+        return value_;
+    }
+
     RangeDistribution<double> rnd_ = RangeDistribution<double>(0.0, 1.0);
     std::tuple<Args...> parts_;
+private:
+    template<size_t... Is>
+    void NextOf(size_t index, std::index_sequence<Is...>) {
+        ((index == Is ? (void)(value_ = std::get<Is>(parts_).Next()) : (void)0), ...);
+    }
+
+    std::array<double, num_parts> probability_;
+    std::array<size_t, num_parts> alias_;
+    ReturnType value_;
 };
 
 template<CombineType type, typename... Args>
 class Combine;
 
+// Chooses one of the parts with probabilities proportional to the numbers of their choices
 template<typename... Args>
 class Combine<DiscreteCombine, Args...> : public Discrete<typename CombineBase<Args...>::ReturnType>, public CombineBase<Args...> {
     //static_assert(are_base_of<Discrete, Args...>::value, "Items given to Combine<DiscreteCombine> must be derived from Discrete");
     typedef typename CombineBase<Args...>::ReturnType ReturnType;
-    using CombineBase<Args...>::rnd_;
     using CombineBase<Args...>::parts_;
 public:
-    Combine(const Args&... args) : CombineBase<Args...>(args...) {}
+    Combine(const Args&... args) : CombineBase<Args...>(args...) {
+        this->BuildTable(std::apply([](auto&... t){ return std::array<double, sizeof...(Args)>{(double)t.ChoiceLength()...}; }, parts_));
+    }
 
     template<typename T>
-    Combine<DiscreteCombine, Args..., T> Added(const T& n) {
-        return std::make_from_tuple<Combine<DiscreteCombine>>(std::tuple_cat(parts_, std::tuple(n)));
+    Combine<DiscreteCombine, Args..., T> Added(const T& n) const {
+        return std::make_from_tuple<Combine<DiscreteCombine, Args..., T>>(std::tuple_cat(parts_, std::tuple(n)));
     }
     template<typename T>
     Combine<WeightedCombine, Args..., T> Added(const T& n, double weight) {
@@ -435,13 +581,7 @@ public:
     }
 
     ReturnType& Next() {
-        auto vals = std::apply([](auto&... t){ return std::vector<ReturnType>({t.Next()...}); }, parts_);
-        auto widths = std::apply([](auto&... t){ return std::vector({t.ChoiceLength()...}); }, parts_);
-        auto rnd = rnd_()*ChoiceLength();
-        size_t pos;
-        for(pos = 0; pos != widths.size() && widths[pos] < rnd; pos++)
-            rnd -= widths[pos];
-        return vals[pos-1];
+        return this->NextValue();
     }
 
     NextType<ReturnType>* Clone() const {
@@ -449,18 +589,20 @@ public:
     }
 };
 
+// Chooses one of the parts with probabilities proportional to the lengths of their ranges
 template<typename... Args>
 class Combine<ContinuousCombine, Args...> : public Continuous<typename CombineBase<Args...>::ReturnType>, public CombineBase<Args...> {
     //static_assert(are_base_of<Continuous, Args...>::value, "Items given to Combine<ContinuousCombine> must be derived from Continuous");
     typedef typename CombineBase<Args...>::ReturnType ReturnType;
-    using CombineBase<Args...>::rnd_;
     using CombineBase<Args...>::parts_;
 public:
-    Combine(const Continuous<Args>&... args) : CombineBase<Args...>(args...) {}
+    Combine(const Args&... args) : CombineBase<Args...>(args...) {
+        this->BuildTable(std::apply([](auto&... t){ return std::array<double, sizeof...(Args)>{(double)t.ChoiceLength()...}; }, parts_));
+    }
 
     template<typename T>
-    Combine<ContinuousCombine, Args..., T> Added(const T& n) {
-        return std::make_from_tuple<Combine<ContinuousCombine>>(std::tuple_cat(parts_, std::tuple(n)));
+    Combine<ContinuousCombine, Args..., T> Added(const T& n) const {
+        return std::make_from_tuple<Combine<ContinuousCombine, Args..., T>>(std::tuple_cat(parts_, std::tuple(n)));
     }
     template<typename T>
     Combine<WeightedCombine, Args..., T> Added(const T& n, double weight) {
@@ -472,13 +614,7 @@ public:
     }
 
     ReturnType& Next() {
-        auto vals = std::apply([](auto&... t){ return std::vector<ReturnType>({t.Next()...}); }, parts_);
-        auto widths = std::apply([](auto&... t){ return std::vector({t.ChoiceLength()...}); }, parts_);
-        auto rnd = rnd_()*ChoiceLength();
-        size_t pos;
-        for(pos = 0; pos != widths.size() && widths[pos] < rnd; pos++)
-            rnd -= widths[pos];
-        return vals[pos-1];
+        return this->NextValue();
     }
 
     NextType<ReturnType>* Clone() const {
@@ -574,7 +710,10 @@ template<typename T, typename S, class = std::enable_if_t<
         (is_base_of_template<T, Continuous>::value && is_base_of_template<S, Continuous>::value)
         || (is_base_of_template<T, Discrete>::value && is_base_of_template<S, Discrete>::value)>>
 auto operator+(const T& l, const S& r) {
-    return Combine(l, r);
+    if constexpr(is_base_of_template<T, Discrete>::value)
+        return Combine<DiscreteCombine, T, S>(l, r);
+    else
+        return Combine<ContinuousCombine, T, S>(l, r);
 }
 template<typename T, typename S, class = std::enable_if_t<is_base_of_template<T, NextType>::value && is_base_of_template<S, NextType>::value>>
 auto operator*(const T& l, const S& r) {
@@ -613,6 +752,14 @@ auto RandomSizeContainer(const Random<size_t>& rnd, std::vector<T> values) {
     return RandomSizeContainer<ContainerT, T>(rnd, Random<T>(values));
 }
 
+// A container with random contents whose size goes through 'sizes' in order, e.g. a SizeLadder
+template<template<typename...> class ContainerT = std::vector, typename T>
+auto SequenceSizeContainer(const std::vector<size_t>& sizes, T min_value, T max_value) {
+    Container<T, ContainerT> cont(SequenceArgument<size_t>{sizes});
+    cont << Random<T>(min_value, max_value);
+    return cont;
+}
+
 // is_Argument<A>::value; true if A is any of the argument types, false otherwise
 template<typename A>
 struct is_Argument : public is_base_of_template<A, Argument> {};
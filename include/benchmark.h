@@ -0,0 +1,54 @@
+/*
+    Repeated timing of tested functions for more reliable run time limits.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+namespace gcheck {
+
+enum RunTimeStatistic : int {
+    Minimum,
+    Median,
+    Mean,
+    Percentile90
+};
+
+/*
+    Options for benchmarking a run. After the warm-up calls the function is called repeatedly until the median
+    is known to relative_error with about 95% confidence, max_samples is reached or max_time has passed.
+    At least min_samples are taken regardless of the time.
+*/
+struct BenchmarkOptions {
+    size_t warmup = 1;
+    size_t min_samples = 5;
+    size_t max_samples = 1000;
+    double relative_error = 0.05;
+    std::chrono::duration<double> max_time = std::chrono::seconds(1);
+    RunTimeStatistic statistic = Median; // The statistic compared to the max run time
+};
+
+// Summary of the run times of a benchmark
+struct RunTimeStats {
+    size_t samples = 0;
+    std::chrono::nanoseconds minimum = std::chrono::nanoseconds::zero();
+    std::chrono::nanoseconds maximum = std::chrono::nanoseconds::zero();
+    std::chrono::nanoseconds mean = std::chrono::nanoseconds::zero();
+    std::chrono::nanoseconds median = std::chrono::nanoseconds::zero();
+    std::chrono::nanoseconds percentile90 = std::chrono::nanoseconds::zero();
+    std::chrono::nanoseconds percentile99 = std::chrono::nanoseconds::zero();
+    std::chrono::nanoseconds mad = std::chrono::nanoseconds::zero(); // Median absolute deviation
+    RunTimeStatistic statistic = Median;
+
+    RunTimeStats() {}
+    RunTimeStats(std::vector<std::chrono::nanoseconds> samples, RunTimeStatistic statistic);
+
+    // The value of 'statistic'
+    std::chrono::nanoseconds Value() const;
+    // Whether the median of 'samples' is known to 'relative_error' with about 95% confidence
+    static bool IsPrecise(const std::vector<std::chrono::nanoseconds>& samples, double relative_error);
+};
+
+} // gcheck
@@ -0,0 +1,44 @@
+/*
+    Estimation of the time complexity of tested functions from run times measured at different input sizes.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <string>
+
+namespace gcheck {
+
+// Candidate complexity classes in increasing order
+enum Complexity : int {
+    O1,
+    OLogN,
+    ON,
+    ONLogN,
+    ON2,
+    ON3
+};
+
+// Human readable name of the class, e.g. "O(n log n)"
+std::string ComplexityName(Complexity c);
+
+/*
+    Fit of run times to coefficient*f(n) where f is the function of the complexity class.
+    error is the root mean square of the residuals relative to the run times.
+*/
+struct ComplexityFit {
+    Complexity complexity = O1;
+    double coefficient = 0; // Nanoseconds per f(n)
+    double error = 0;
+};
+
+// Fits the run times to the given complexity class with least squares
+ComplexityFit FitComplexity(const std::vector<size_t>& sizes, const std::vector<std::chrono::nanoseconds>& run_times, Complexity complexity);
+// Fits the run times to all the complexity classes. The best fit is first.
+std::vector<ComplexityFit> FitComplexities(const std::vector<size_t>& sizes, const std::vector<std::chrono::nanoseconds>& run_times);
+
+// 'count' sizes from 'first' to 'last' growing geometrically, e.g. for the sizes of Container arguments
+std::vector<size_t> SizeLadder(size_t first, size_t last, size_t count);
+
+} // gcheck
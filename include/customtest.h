@@ -14,9 +14,22 @@ namespace gcheck {
 class CustomTest : public Test {
     void ActualTest() override;
     virtual void TheTest() = 0; // The test function specified by user
+    // Adds the set limits to limits_, and applies them right away when called in the forked process of the test
+    void SetLimits(const ResourceLimits& limits);
+
+    bool forked_ = false; // Set in the forked process of a --safe run
 
 protected:
     double timeout_ = 0;
+    ResourceLimits limits_; // Limits for the test when running with --safe
+
+    /* Limits for the test when running with --safe, see ResourceLimits. Limits set before the test is run apply to
+    all of it, and limits set in the test body apply to the rest of it. */
+    void SetMaxCPUTime(double seconds);
+    void SetMaxMemory(size_t bytes);
+    void SetMaxFileSize(size_t bytes);
+    void SetMaxProcesses(size_t n);
+
     /* Runs num tests with correct(args...) giving correct answer
     and under_test(arg...) giving the testing answer and adds the results to test data */
     template <class F, class S, class... Args>
@@ -0,0 +1,161 @@
+/*
+    Flat, pointer free form of the test results for handing them from forked processes to the parent.
+    The child writes the results straight to the shared memory and the parent reads them in place.
+*/
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <chrono>
+#include <type_traits>
+
+namespace gcheck {
+
+template<template<typename> class allocator>
+class _TestReport;
+template<template<typename> class allocator>
+struct _EqualsData;
+template<template<typename> class allocator>
+struct _TrueData;
+template<template<typename> class allocator>
+struct _FalseData;
+template<template<typename> class allocator>
+struct _CaseEntry;
+template<template<typename> class allocator>
+struct _FunctionEntry;
+template<template<typename> class allocator>
+struct _ComplexityData;
+template<template<typename> class allocator>
+struct _TestData;
+template<template<typename> class allocator>
+class _UserObject;
+struct ResourceUsage;
+struct RunTimeStats;
+struct ComplexityFit;
+struct PerfCounters;
+struct AllocationStats;
+struct OutputComparison;
+
+/*
+    Writes values to a fixed size block of memory. The block starts with the number of bytes written
+    after it, so a reader doesn't need to know the size beforehand. Throws std::bad_alloc if the block runs out.
+*/
+class FlatWriter {
+public:
+    FlatWriter(void* memory, size_t size);
+
+    void Write(const void* data, size_t n);
+    // Total number of bytes used including the size header
+    size_t Size() const { return used_; }
+private:
+    char* memory_;
+    size_t size_;
+    size_t used_;
+};
+
+/*
+    Reads values written by FlatWriter. Throws std::runtime_error if the data ends prematurely.
+*/
+class FlatReader {
+public:
+    FlatReader(const void* memory, size_t size);
+
+    void Read(void* data, size_t n);
+    // Returns a view to the next n bytes without copying them
+    std::string_view View(size_t n);
+private:
+    const char* memory_;
+    size_t end_;
+    size_t position_;
+};
+
+template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> || std::is_enum_v<T>>>
+void Flatten(FlatWriter& w, const T& value) {
+    w.Write(&value, sizeof(T));
+}
+template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> || std::is_enum_v<T>>>
+void Unflatten(FlatReader& r, T& value) {
+    r.Read(&value, sizeof(T));
+}
+
+void Flatten(FlatWriter& w, const std::string& str);
+void Unflatten(FlatReader& r, std::string& str);
+
+template<typename Rep, typename Period>
+void Flatten(FlatWriter& w, const std::chrono::duration<Rep, Period>& d) {
+    Flatten(w, d.count());
+}
+template<typename Rep, typename Period>
+void Unflatten(FlatReader& r, std::chrono::duration<Rep, Period>& d) {
+    Rep count;
+    Unflatten(r, count);
+    d = std::chrono::duration<Rep, Period>(count);
+}
+
+template<typename T>
+void Flatten(FlatWriter& w, const std::optional<T>& o) {
+    Flatten(w, o.has_value());
+    if(o)
+        Flatten(w, *o);
+}
+template<typename T>
+void Unflatten(FlatReader& r, std::optional<T>& o) {
+    bool has_value;
+    Unflatten(r, has_value);
+    if(has_value)
+        Unflatten(r, o.emplace());
+    else
+        o.reset();
+}
+
+template<typename T>
+void Flatten(FlatWriter& w, const std::vector<T>& v) {
+    Flatten(w, v.size());
+    for(auto& item : v)
+        Flatten(w, item);
+}
+template<typename T>
+void Unflatten(FlatReader& r, std::vector<T>& v) {
+    size_t size;
+    Unflatten(r, size);
+    v.resize(size);
+    for(auto& item : v)
+        Unflatten(r, item);
+}
+
+void Flatten(FlatWriter& w, const ResourceUsage& u);
+void Unflatten(FlatReader& r, ResourceUsage& u);
+void Flatten(FlatWriter& w, const RunTimeStats& s);
+void Unflatten(FlatReader& r, RunTimeStats& s);
+void Flatten(FlatWriter& w, const PerfCounters& c);
+void Unflatten(FlatReader& r, PerfCounters& c);
+void Flatten(FlatWriter& w, const AllocationStats& s);
+void Unflatten(FlatReader& r, AllocationStats& s);
+void Flatten(FlatWriter& w, const OutputComparison& c);
+void Unflatten(FlatReader& r, OutputComparison& c);
+void Flatten(FlatWriter& w, const _UserObject<std::allocator>& o);
+void Unflatten(FlatReader& r, _UserObject<std::allocator>& o);
+void Flatten(FlatWriter& w, const _EqualsData<std::allocator>& d);
+void Unflatten(FlatReader& r, _EqualsData<std::allocator>& d);
+void Flatten(FlatWriter& w, const _TrueData<std::allocator>& d);
+void Unflatten(FlatReader& r, _TrueData<std::allocator>& d);
+void Flatten(FlatWriter& w, const _FalseData<std::allocator>& d);
+void Unflatten(FlatReader& r, _FalseData<std::allocator>& d);
+void Flatten(FlatWriter& w, const _CaseEntry<std::allocator>& e);
+void Unflatten(FlatReader& r, _CaseEntry<std::allocator>& e);
+void Flatten(FlatWriter& w, const _FunctionEntry<std::allocator>& e);
+void Unflatten(FlatReader& r, _FunctionEntry<std::allocator>& e);
+void Flatten(FlatWriter& w, const ComplexityFit& f);
+void Unflatten(FlatReader& r, ComplexityFit& f);
+void Flatten(FlatWriter& w, const _ComplexityData<std::allocator>& d);
+void Unflatten(FlatReader& r, _ComplexityData<std::allocator>& d);
+void Flatten(FlatWriter& w, const _TestReport<std::allocator>& r);
+void Unflatten(FlatReader& r, _TestReport<std::allocator>& report);
+// The prerequisite isn't transferred, like in the allocator converting assignment of _TestData
+void Flatten(FlatWriter& w, const _TestData<std::allocator>& d);
+void Unflatten(FlatReader& r, _TestData<std::allocator>& d);
+
+} // gcheck
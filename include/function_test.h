@@ -4,12 +4,15 @@
 #include <functional>
 #include <chrono>
 #include <stdexcept>
+#include <algorithm>
+#include <set>
 
 #include "macrotools.h"
 #include "gcheck.h"
 #include "sfinae.h"
 #include "user_object.h"
 #include "multiprocessing.h"
+#include "random.h"
 
 namespace gcheck {
 
@@ -175,7 +178,17 @@ protected:
     std::optional<StorageTupleType> args_after_;
     std::optional<ReturnType> expected_return_value_;
     std::optional<std::chrono::nanoseconds> max_run_time_;
+    std::optional<BenchmarkOptions> benchmark_;
     std::chrono::duration<double> timeout_ = std::chrono::duration<double>::zero();
+    std::optional<size_t> safe_batch_size_;
+    ResourceLimits limits_;
+    std::optional<Complexity> complexity_;
+    bool count_perf_ = false;
+    PerfCounters max_perf_counters_;
+    bool track_allocations_ = false;
+    std::optional<size_t> max_allocations_;
+    std::optional<size_t> max_peak_bytes_;
+    std::optional<size_t> size_;
 
     std::optional<StorageTupleType> last_args_;
     int num_runs_;
@@ -208,8 +221,35 @@ protected:
     void SetReturn(const ReturnType& val) { expected_return_value_ = val; }
     void SetMaxRunTime(std::chrono::nanoseconds ns) { max_run_time_ = ns; }
     void SetMaxRunTime(unsigned long long ns) { max_run_time_ = std::chrono::nanoseconds(ns); }
+    // Times each run repeatedly and uses the chosen statistic of the samples as the run time.
+    // The tested function must give the same results when it is called again with the same inputs.
+    void SetBenchmark(const BenchmarkOptions& options = BenchmarkOptions()) { benchmark_ = options; }
     void SetTimeout(std::chrono::duration<double> seconds) { timeout_ = seconds; }
     void SetTimeout(double seconds) { timeout_ = std::chrono::duration<double>(seconds); }
+    // Sets the number of runs done in one forked process when running with --safe
+    void SetSafeBatchSize(size_t n) { safe_batch_size_ = n; }
+    // Limits for each run when running with --safe, see ResourceLimits
+    void SetMaxCPUTime(double seconds) { limits_.cpu_time = seconds; }
+    void SetMaxMemory(size_t bytes) { limits_.memory = bytes; }
+    void SetMaxFileSize(size_t bytes) { limits_.file_size = bytes; }
+    void SetMaxProcesses(size_t n) { limits_.processes = n; }
+    // Counts instructions, cycles, cache misses and branch misses of the calls with perf events, see PerfCounters
+    void SetPerfCounters(bool enable = true) { count_perf_ = enable; }
+    // Limits for the counts. Limits of counters unavailable on the machine aren't checked.
+    void SetMaxInstructions(uint64_t n) { max_perf_counters_.instructions = n; count_perf_ = true; }
+    void SetMaxCycles(uint64_t n) { max_perf_counters_.cycles = n; count_perf_ = true; }
+    void SetMaxCacheMisses(uint64_t n) { max_perf_counters_.cache_misses = n; count_perf_ = true; }
+    void SetMaxBranchMisses(uint64_t n) { max_perf_counters_.branch_misses = n; count_perf_ = true; }
+    // Records the heap allocations of the calls, see AllocationStats. The recording slows down the calls that allocate.
+    void SetTrackAllocations(bool enable = true) { track_allocations_ = enable; }
+    // Limits for the number of allocations and the peak of allocated bytes of a call
+    void SetMaxAllocations(size_t n) { max_allocations_ = n; track_allocations_ = true; }
+    void SetMaxPeakBytes(size_t bytes) { max_peak_bytes_ = bytes; track_allocations_ = true; }
+    // Fits the run times of the runs to complexity classes by their sizes and adds a report that
+    // is correct if the best fit is at most 'bound'. Vary the size between runs e.g. with SizeLadder.
+    void SetComplexity(Complexity bound) { complexity_ = bound; }
+    // Sets the input size of the run for SetComplexity. Defaults to the size of the first argument if it is a container.
+    void SetSize(size_t n) { size_ = n; }
 
     const std::optional<TupleType>& GetLastArguments() const { return last_args_; }
     size_t GetRunIndex() { return run_index_; }
@@ -220,6 +260,22 @@ protected:
     virtual void ResetTestVars();
 private:
     virtual void ActualTest();
+    // Resets the test variables and sets the inputs and outputs for run 'index'
+    void PrepareRun(size_t index);
+    // RunOnce with the resource limits applied. Stores the resources used by the run to data.
+    void RunOnceLimited(FunctionEntry& data);
+    // Times the function repeatedly with the arguments of the run and stores the statistics to data
+    void Benchmark(FunctionEntry& data);
+    // Calls 'call' and stores the run time and the enabled measurements of the call to data
+    template<typename F>
+    decltype(auto) Measure(FunctionEntry& data, F&& call);
+    // The input size of the prepared run for SetComplexity
+    std::optional<size_t> RunSize() const;
+    // Adds the report and the complexity report if SetComplexity was used
+    void FinishTest(TestReport& report);
+
+    std::vector<std::optional<size_t>> run_sizes_;
+    PerfCounterGroup perf_counter_group_;
 
     std::function<ReturnT(Args...)> function_;
 };
@@ -229,6 +285,7 @@ void FunctionTest<ReturnT, Args...>::ResetTestVars() {
     args_.reset();
     args_after_.reset();
     expected_return_value_.reset();
+    size_.reset();
     check_arguments_ = true;
 }
 
@@ -252,15 +309,11 @@ void FunctionTest<ReturnT, Args...>::RunOnce(FunctionEntry& data) {
             data.arguments = args;
 
             if constexpr(std::is_same<ReturnT, void>::value) {
-                auto t1 = std::chrono::high_resolution_clock::now();
-                std::apply(function_, args);
-                data.run_time = std::chrono::high_resolution_clock::now() - t1;
+                Measure(data, [this, &args]() { return std::apply(function_, args); });
 
                 data.result = true;
             } else {
-                auto t1 = std::chrono::high_resolution_clock::now();
-                auto ret = std::apply(function_, args);
-                data.run_time = std::chrono::high_resolution_clock::now() - t1;
+                auto ret = Measure(data, [this, &args]() { return std::apply(function_, args); });
 
                 data.return_value = ret;
                 if(expected_return_value_)
@@ -274,15 +327,11 @@ void FunctionTest<ReturnT, Args...>::RunOnce(FunctionEntry& data) {
             data.result = false;
         }
     } else if constexpr(std::is_same<ReturnT, void>::value) {
-        auto t1 = std::chrono::high_resolution_clock::now();
-        function_();
-        data.run_time = std::chrono::high_resolution_clock::now() - t1;
+        Measure(data, [this]() { return function_(); });
 
         data.result = !args_after_ && !args_;
     } else {
-        auto t1 = std::chrono::high_resolution_clock::now();
-        auto ret = function_();
-        data.run_time = std::chrono::high_resolution_clock::now() - t1;
+        auto ret = Measure(data, [this]() { return function_(); });
 
         data.return_value = ret;
         if(expected_return_value_)
@@ -290,12 +339,182 @@ void FunctionTest<ReturnT, Args...>::RunOnce(FunctionEntry& data) {
         data.result = (!expected_return_value_ || *expected_return_value_ == ret) && (!args_after_ && !args_);
     }
 
+    // The arguments and the return value are destroyed by now, so the blocks still recorded were leaked
+    if(track_allocations_)
+        data.allocation_stats = AllocationTracker::Stop();
+
+    for(auto& f : post_run_functions_)
+        f(run_index_, data);
+
+    if(benchmark_)
+        Benchmark(data);
+
     data.max_run_time = max_run_time_;
     if(max_run_time_)
         data.result = data.result && data.run_time <= max_run_time_.value();
 
-    for(auto& f : post_run_functions_)
-        f(run_index_, data);
+    data.max_allocations = max_allocations_;
+    data.max_peak_bytes = max_peak_bytes_;
+    if(data.allocation_stats) {
+        if(max_allocations_)
+            data.result = data.result && data.allocation_stats->allocations <= *max_allocations_;
+        if(max_peak_bytes_)
+            data.result = data.result && data.allocation_stats->peak_bytes <= *max_peak_bytes_;
+    }
+
+    if(!max_perf_counters_.Empty()) {
+        data.max_perf_counters = max_perf_counters_;
+        if(data.perf_counters)
+            data.result = data.result && data.perf_counters->IsWithin(max_perf_counters_);
+    }
+}
+
+template<typename ReturnT, typename... Args>
+template<typename F>
+decltype(auto) FunctionTest<ReturnT, Args...>::Measure(FunctionEntry& data, F&& call) {
+    // Stops the measurements when the call returns, after the return value is constructed
+    struct Stopper {
+        FunctionTest& test;
+        FunctionEntry& data;
+        std::chrono::high_resolution_clock::time_point start;
+        ~Stopper() {
+            data.run_time = std::chrono::high_resolution_clock::now() - start;
+            if(test.count_perf_)
+                data.perf_counters = test.perf_counter_group_.Stop();
+            // Frees are tracked until the arguments and the return value are destroyed
+            if(test.track_allocations_)
+                AllocationTracker::Pause();
+        }
+    };
+
+    if(track_allocations_)
+        AllocationTracker::Start();
+    if(count_perf_)
+        perf_counter_group_.Start();
+    Stopper stopper{*this, data, std::chrono::high_resolution_clock::now()};
+    return call();
+}
+
+template<typename ReturnT, typename... Args>
+void FunctionTest<ReturnT, Args...>::PrepareRun(size_t index) {
+    run_index_ = index;
+    SetRandomRun(GetSuite(), GetTest(), index);
+
+    ResetTestVars();
+
+    for(auto& f : reset_vars_functions_)
+        f();
+
+    SetInputsAndOutputs();
+
+    if(complexity_) {
+        if(run_sizes_.size() <= index)
+            run_sizes_.resize(index + 1);
+        run_sizes_[index] = RunSize();
+    }
+}
+
+template<typename ReturnT, typename... Args>
+std::optional<size_t> FunctionTest<ReturnT, Args...>::RunSize() const {
+    if(size_)
+        return size_;
+
+    if constexpr(sizeof...(Args) != 0) {
+        typedef std::tuple_element_t<0, StorageTupleType> First;
+        if constexpr(has_begin_end<First>::value) {
+            if(args_)
+                return (size_t)std::distance(std::get<0>(*args_).begin(), std::get<0>(*args_).end());
+        }
+    }
+    return std::nullopt;
+}
+
+template<typename ReturnT, typename... Args>
+void FunctionTest<ReturnT, Args...>::FinishTest(TestReport& report) {
+    AddReport(report);
+
+    if(complexity_) {
+        TestReport complexity_report = TestReport::Make<ComplexityData>();
+        auto& cx = complexity_report.Get<ComplexityData>();
+        auto& data = report.Get<FunctionData>();
+
+        // Failed runs don't have a meaningful run time
+        for(size_t i = 0; i < data.size() && i < run_sizes_.size(); i++) {
+            if(data[i].status != OK || !run_sizes_[i])
+                continue;
+            cx.sizes.push_back(*run_sizes_[i]);
+            cx.run_times.push_back(data[i].run_time);
+        }
+        cx.bound = *complexity_;
+
+        size_t distinct = std::set<size_t>(cx.sizes.begin(), cx.sizes.end()).size();
+        if(distinct >= 2)
+            cx.fits = FitComplexities(cx.sizes, cx.run_times);
+        cx.result = !cx.fits.empty() && cx.fits.front().complexity <= cx.bound;
+        if(distinct < 2)
+            complexity_report.info_stream << "At least two different input sizes are needed for estimating the complexity";
+
+        AddReport(complexity_report);
+    }
+
+    data_.status = Finished;
+}
+
+template<typename ReturnT, typename... Args>
+void FunctionTest<ReturnT, Args...>::Benchmark(FunctionEntry& data) {
+    if constexpr(sizeof...(Args) != 0) {
+        if(!last_args_)
+            return;
+    }
+
+    // The pre and post run functions are called around each call, so that e.g. the input and output are redirected
+    auto call = [this]() {
+        FunctionEntry scratch;
+        for(auto& f : pre_run_functions_)
+            f(run_index_, scratch);
+
+        std::chrono::steady_clock::duration time;
+        if constexpr(sizeof...(Args) != 0) {
+            auto args = (TupleType)*last_args_;
+            auto t1 = std::chrono::steady_clock::now();
+            std::apply(function_, args);
+            time = std::chrono::steady_clock::now() - t1;
+        } else {
+            auto t1 = std::chrono::steady_clock::now();
+            function_();
+            time = std::chrono::steady_clock::now() - t1;
+        }
+
+        for(auto& f : post_run_functions_)
+            f(run_index_, scratch);
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time);
+    };
+
+    for(size_t i = 0; i < benchmark_->warmup; i++)
+        call();
+
+    std::vector<std::chrono::nanoseconds> samples;
+    auto start = std::chrono::steady_clock::now();
+    while(samples.size() < std::max<size_t>(benchmark_->max_samples, 1)) {
+        samples.push_back(call());
+
+        if(samples.size() < benchmark_->min_samples)
+            continue;
+        if(std::chrono::steady_clock::now() - start >= benchmark_->max_time
+                || RunTimeStats::IsPrecise(samples, benchmark_->relative_error))
+            break;
+    }
+
+    data.run_time_stats = RunTimeStats(samples, benchmark_->statistic);
+    data.run_time = data.run_time_stats->Value();
+}
+
+template<typename ReturnT, typename... Args>
+void FunctionTest<ReturnT, Args...>::RunOnceLimited(FunctionEntry& data) {
+    auto usage = ResourceUsage::Self();
+    limits_.Apply();
+    RunOnce(data);
+    data.resource_usage = ResourceUsage::Self() - usage;
 }
 
 template<typename ReturnT, typename... Args>
@@ -305,19 +524,83 @@ void FunctionTest<ReturnT, Args...>::ActualTest() {
 
     data.resize(num_runs_);
 
-    run_index_ = 0;
-    for(auto it = data.begin(); it != data.end(); it++, run_index_++) {
-        ResetTestVars();
+    if(do_safe_run_ && use_fork_server_) {
+#if defined(__linux__)
+        // The worker prepares each run itself and keeps the state between runs like a run without --safe would.
+        // This process prepares the runs too so that a restarted worker starts from the right state.
+        ForkServer server([this, &data](size_t index, shared_manager& memory) {
+            PrepareRun(index);
+            RunOnceLimited(data[index]);
+            WriteFlat(memory, data[index]);
+        });
+
+        for(size_t index = 0; index < data.size(); index++) {
+            server.Start();
+            PrepareRun(index);
+
+            auto& entry = data[index];
+            ResourceUsage usage;
+            entry.status = server.Run(index, timeout_, usage);
+            // The worker measures a finished run itself, without the preparations
+            if(entry.status == OK)
+                ReadFlat(server.Memory(), entry);
+            else
+                entry.resource_usage = usage;
+            entry.result = entry.result && entry.status == OK;
+            entry.timeout = timeout_;
+        }
+#else
+        throw std::runtime_error("Safe running is only supported on linux.");
+#endif
+        FinishTest(report);
+        return;
+    }
 
-        for(auto& f : reset_vars_functions_)
-            f();
+    size_t batch_size = safe_batch_size_.value_or(default_safe_batch_size_);
+    if(do_safe_run_ && batch_size > 1) {
+#if defined(__linux__)
+        size_t index = 0;
+        while(index < data.size()) {
+            size_t first = index;
+            size_t end = std::min(first + batch_size, data.size());
+            // The first run is prepared here so that the timeout it sets applies to the batch
+            PrepareRun(first);
+            ResourceUsage usage;
+            auto [finished, status] = RunForkedBatch(timeout_, data, first, end, usage,
+                    [this, &data, first](size_t i) { if(i != first) PrepareRun(i); RunOnceLimited(data[i]); });
+
+            // Prepare the other runs done by the child here too, so that the next child starts from the right state
+            index = first + finished;
+            for(size_t i = first + 1; i < index + (status != OK); i++)
+                PrepareRun(i);
+
+            if(status != OK) {
+                data[index].status = status;
+                data[index].result = false;
+                data[index].resource_usage = usage;
+                index++;
+            }
+        }
+        for(auto& entry : data) {
+            entry.result = entry.result && entry.status == OK;
+            entry.timeout = timeout_;
+        }
+#else
+        throw std::runtime_error("Safe running is only supported on linux.");
+#endif
+        FinishTest(report);
+        return;
+    }
 
-        SetInputsAndOutputs();
+    for(auto it = data.begin(); it != data.end(); it++) {
+        PrepareRun(it - data.begin());
 
         if(do_safe_run_) {
 #if defined(__linux__)
-            it->status = gcheck::RunForked(timeout_, *it, 1024*1024, std::bind(&FunctionTest::RunOnce, this, std::placeholders::_1), *it);
+            ResourceUsage usage;
+            it->status = gcheck::RunForkedLimited(timeout_, limits_, usage, *it, std::bind(&FunctionTest::RunOnce, this, std::placeholders::_1), *it);
             it->result = it->result && it->status == OK;
+            it->resource_usage = usage;
 #else
             throw std::runtime_error("Safe running is only supported on linux.");
 #endif
@@ -326,8 +609,7 @@ void FunctionTest<ReturnT, Args...>::ActualTest() {
         }
         it->timeout = timeout_;
     }
-    AddReport(report);
-    data_.status = Finished;
+    FinishTest(report);
 }
 
 } // gcheck
@@ -338,6 +620,22 @@ void FunctionTest<ReturnT, Args...>::ActualTest() {
     template<typename ReturnT, typename... Args> \
     class GCHECK_TEST_##suitename##_##testname : public gcheck::FunctionTest<ReturnT, Args...> { \
         using gcheck::FunctionTest<ReturnT, Args...>::SetTimeout; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSafeBatchSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCPUTime; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxMemory; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxFileSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxProcesses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetBenchmark; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetComplexity; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetPerfCounters; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxInstructions; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCycles; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCacheMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxBranchMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetTrackAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxPeakBytes; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArguments; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArgumentsAfter; \
         using gcheck::FunctionTest<ReturnT, Args...>::IgnoreArgumentsAfter; \
@@ -360,6 +658,22 @@ void FunctionTest<ReturnT, Args...>::ActualTest() {
     template<typename ReturnT, typename... Args> \
     class GCHECK_TEST_##suitename##_##testname : public gcheck::FunctionTest<ReturnT, Args...> { \
         using gcheck::FunctionTest<ReturnT, Args...>::SetTimeout; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSafeBatchSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCPUTime; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxMemory; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxFileSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxProcesses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetBenchmark; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetComplexity; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetPerfCounters; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxInstructions; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCycles; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCacheMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxBranchMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetTrackAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxPeakBytes; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArguments; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArgumentsAfter; \
         using gcheck::FunctionTest<ReturnT, Args...>::IgnoreArgumentsAfter; \
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <sstream>
 #include <memory>
+#include <unordered_map>
 #include <variant>
 #include <chrono>
 
@@ -15,6 +16,11 @@
 #include "sfinae.h"
 #include "macrotools.h"
 #include "multiprocessing.h"
+#include "benchmark.h"
+#include "complexity.h"
+#include "perf_counters.h"
+#include "allocation_tracker.h"
+#include "redirectors.h"
 
 namespace gcheck {
 
@@ -162,7 +168,16 @@ struct _FunctionEntry {
     std::optional<UO> object_after_expected;
     std::optional<std::chrono::nanoseconds> max_run_time;
     std::chrono::nanoseconds run_time;
+    std::optional<RunTimeStats> run_time_stats; // Set when benchmarked, run_time is then the chosen statistic
     std::chrono::duration<double> timeout;
+    std::optional<ResourceUsage> resource_usage; // Resources used by the run when run with --safe
+    std::optional<PerfCounters> perf_counters; // Set when the performance counters are enabled
+    std::optional<PerfCounters> max_perf_counters;
+    std::optional<AllocationStats> allocation_stats; // Set when the allocations are tracked
+    std::optional<size_t> max_allocations;
+    std::optional<size_t> max_peak_bytes;
+    std::optional<OutputComparison> output_comparison; // Set when the output didn't match, output and output_expected are then windows of them
+    std::optional<OutputComparison> error_comparison;
     ForkStatus status = OK;
     bool result;
 
@@ -189,7 +204,16 @@ struct _FunctionEntry {
         object_after_expected = fe.object_after_expected;
         max_run_time = fe.max_run_time;
         run_time = fe.run_time;
+        run_time_stats = fe.run_time_stats;
         timeout = fe.timeout;
+        resource_usage = fe.resource_usage;
+        perf_counters = fe.perf_counters;
+        max_perf_counters = fe.max_perf_counters;
+        allocation_stats = fe.allocation_stats;
+        max_allocations = fe.max_allocations;
+        max_peak_bytes = fe.max_peak_bytes;
+        output_comparison = fe.output_comparison;
+        error_comparison = fe.error_comparison;
         status = fe.status;
         result = fe.result;
         return *this;
@@ -200,18 +224,52 @@ template<template<typename> class allocator = std::allocator>
 using _FunctionData = std::vector<_FunctionEntry<allocator>, allocator<_FunctionEntry<allocator>>>;
 using FunctionData = _FunctionData<>;
 
+// Run times of a function test at different input sizes and their fit to the complexity classes
+template<template<typename> class allocator = std::allocator>
+struct _ComplexityData {
+    std::vector<size_t, allocator<size_t>> sizes;
+    std::vector<std::chrono::nanoseconds, allocator<std::chrono::nanoseconds>> run_times;
+    Complexity bound;
+    std::vector<ComplexityFit, allocator<ComplexityFit>> fits; // Best fit first, empty if there were too few sizes
+    bool result;
+
+    _ComplexityData() {}
+
+    template<template<typename> class T>
+    _ComplexityData(const _ComplexityData<T>& d) {
+        *this = d;
+    }
+    template<template<typename> class T>
+    _ComplexityData& operator=(const _ComplexityData<T>& d) {
+        sizes.assign(d.sizes.begin(), d.sizes.end());
+        run_times.assign(d.run_times.begin(), d.run_times.end());
+        bound = d.bound;
+        fits.assign(d.fits.begin(), d.fits.end());
+        result = d.result;
+        return *this;
+    }
+};
+using ComplexityData = _ComplexityData<>;
+
 template<template<typename> class allocator = std::allocator>
 struct _TestReport {
     typedef std::basic_stringstream<char, std::char_traits<char>, allocator<char>> stringstream;
     stringstream info_stream;
 
-    std::variant<_EqualsData<allocator>, _TrueData<allocator>, _FalseData<allocator>, _CaseData<allocator>, _FunctionData<allocator>> data;
+    std::variant<_EqualsData<allocator>, _TrueData<allocator>, _FalseData<allocator>, _CaseData<allocator>, _FunctionData<allocator>, _ComplexityData<allocator>> data;
 
     _TestReport(const _TestReport& r) : data(r.data) { info_stream << r.info_stream.str(); }
+    _TestReport& operator=(const _TestReport& r) {
+        data = r.data;
+        info_stream.str("");
+        info_stream << r.info_stream.str();
+        return *this;
+    }
     template<typename T>
     _TestReport(const T& d) : data(d) {}
     template<template<typename> class T>
     _TestReport(const _TestReport<T>& r) {
+        info_stream << r.info_stream.str();
         switch (r.data.index()) {
         case 0:
             data = std::get<0>(r.data);
@@ -230,7 +288,10 @@ struct _TestReport {
             auto& vec = std::get<4>(r.data);
             data = _FunctionData<allocator>(vec.begin(), vec.end());
             break;
-        } default:
+        } case 5:
+            data = _ComplexityData<allocator>(std::get<5>(r.data));
+            break;
+        default:
             break;
         }
     }
@@ -262,10 +323,12 @@ enum TestStatus : int {
     NotStarted,
     Started,
     TimedOut,
-    Finished
+    Finished,
+    Crashed
 };
 
 class Test;
+class TestScheduler;
 class Prerequisite {
 public:
     Prerequisite() {}
@@ -274,6 +337,7 @@ public:
     bool IsFulfilled();
     bool IsFulfilled() const;
     std::vector<std::tuple<std::string, std::string, bool>> GetFullfillmentData() const;
+    const std::vector<std::pair<std::string, std::string>>& GetNames() const { return names_; }
 private:
     void FetchTests();
 
@@ -315,6 +379,9 @@ struct _TestData {
     int correct = 0;
     int incorrect = 0;
 
+    // Resources used by the forked process that ran the whole test, if one did
+    std::optional<ResourceUsage> resource_usage;
+
     _TestData(double points, Prerequisite prerequisite) : prerequisite(prerequisite), max_points(points) {}
     template<template<typename> class T>
     _TestData(const _TestData<T>& td) {
@@ -328,6 +395,7 @@ struct _TestData {
         serr = td.serr;
         correct = td.correct;
         incorrect = td.incorrect;
+        resource_usage = td.resource_usage;
         prerequisite = td.prerequisite;
     }
     template<template<typename> class T>
@@ -342,6 +410,7 @@ struct _TestData {
         serr = td.serr;
         correct = td.correct;
         incorrect = td.incorrect;
+        resource_usage = td.resource_usage;
         return *this;
     }
 
@@ -377,16 +446,26 @@ class Test {
         static std::unique_ptr<std::vector<Test*>> list(new std::vector<Test*>());
         return *list;
     }
+    // Tests indexed by "suite.test" for FindTest
+    static std::unordered_map<std::string, Test*>& test_index_() {
+        static std::unique_ptr<std::unordered_map<std::string, Test*>> index(new std::unordered_map<std::string, Test*>());
+        return *index;
+    }
 
     virtual void ActualTest() = 0; // The test function specified by inheritor
 
     void RunTest(); // Runs the test and takes care of result logging to Formatter
+
+    static unsigned int RunSerial(TestScheduler& scheduler); // Runs the tests in this process
+    static unsigned int RunParallel(TestScheduler& scheduler); // Runs the tests in forked workers
 protected:
     TestData data_;
     std::string suite_;
     std::string test_;
 
     TestReport& AddReport(TestReport& report);
+    // Marks data as not finished with status and adds an incorrect entry with the reason, also printed to stderr
+    void ReportUnfinished(TestData& data, TestStatus status, const std::string& reason);
     void SetGradingMethod(GradingMethod method);
     void OutputFormat(std::string format);
 
@@ -396,8 +475,13 @@ public:
     bool IsPassed() const;
     const std::string& GetSuite() const { return suite_; }
     const std::string& GetTest() const { return test_; }
+    const Prerequisite& GetPrerequisite() const { return data_.prerequisite; }
 
     static bool do_safe_run_;
+    static bool use_fork_server_; // Whether safe runs use a persistent worker instead of a fork per run
+    static size_t default_safe_batch_size_; // Number of runs done in one forked process by default
+    static int jobs_; // Number of tests run at the same time in forked workers
+    static bool report_passed_details_; // Whether the arguments, return values etc. of passing cases are reported
 
     static bool RunTests();
     static Test* FindTest(std::string suite, std::string test);
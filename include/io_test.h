@@ -27,19 +27,35 @@ protected:
     StdinInjecter tin_;
 
     std::optional<std::string> input_;
+    std::optional<std::string> input_file_;
     std::optional<std::string> expected_output_;
     std::optional<std::string> expected_error_;
     bool do_close = false;
+    size_t output_limit_ = 64 << 20;
+
+    // Bytes of the output and the expected output reported on each side of the first mismatch
+    static constexpr size_t mismatch_context_ = 64;
 
     // Sets the input (stdin) given to the tested function
-    void SetInput(const std::string& str, bool close_stream = false) { input_ = str; do_close = close_stream; }
+    void SetInput(const std::string& str, bool close_stream = false) { input_ = str; input_file_.reset(); do_close = close_stream; }
+    /*
+        Sets a file whose contents are given to the tested function as input (stdin), e.g. a test fixture.
+        The file is read directly instead of being loaded into memory first. The input ends at the end of the file.
+    */
+    void SetInputFile(const std::string& path) { input_file_ = path; input_.reset(); }
     // Sets the expected output (stdout) of tested function
     void SetOutput(const std::string& str) { expected_output_ = str; }
     // Sets the expected error (stderr) of tested function
     void SetError(const std::string& str) { expected_error_ = str; }
+    /*
+        Sets the maximum number of bytes kept and compared of both the output and the error of a run.
+        The run fails if it writes more, or more than the expected output if it's longer. Defaults to 64 MiB.
+    */
+    void SetOutputLimit(size_t bytes) { output_limit_ = bytes; }
 
     void ResetTestVars() {
         input_.reset();
+        input_file_.reset();
         expected_output_.reset();
         expected_error_.reset();
         do_close = false;
@@ -50,10 +66,15 @@ private:
             tin_.Capture();
             tin_.Write(*input_);
             if(do_close) tin_.Close();
+        } else if(input_file_) {
+            tin_.Open(*input_file_);
         }
 
-        tout_.Capture();
-        terr_.Capture();
+        auto view = [](const std::optional<std::string>& str) {
+            return str ? std::optional<std::string_view>(*str) : std::nullopt;
+        };
+        tout_.Stream(view(expected_output_), output_limit_, mismatch_context_).Capture();
+        terr_.Stream(view(expected_error_), output_limit_, mismatch_context_).Capture();
     }
     void PostRun(size_t, FunctionEntry& entry) {
         tout_.Restore();
@@ -61,16 +82,37 @@ private:
         tin_.Restore();
 
         if(input_) entry.input = *input_;
+        else if(input_file_) entry.input = "< " + *input_file_;
+
+        bool output_matches = Report(tout_, expected_output_, entry.output, entry.output_expected, entry.output_comparison);
+        bool error_matches = Report(terr_, expected_error_, entry.error, entry.error_expected, entry.error_comparison);
+        entry.result = entry.result && output_matches && error_matches;
+    }
+
+    /*
+        Fills in the output and the expected output from the comparison done while capturing.
+        On a mismatch only windows of them around the first differing byte are reported.
+    */
+    bool Report(FileCapturer& capturer, const std::optional<std::string>& expected, std::optional<UserObject>& output,
+            std::optional<UserObject>& output_expected, std::optional<OutputComparison>& comparison) {
+        const OutputComparison& result = capturer.Comparison();
+        std::string_view kept = capturer.view();
+
+        if(!expected) {
+            output = std::string(kept);
+        } else if(!result.mismatch) {
+            // The output was the same as the expected one
+            output = *expected;
+            output_expected = *expected;
+        } else {
+            size_t same = *result.mismatch - result.window;
+            output = expected->substr(result.window, same) + std::string(kept);
+            output_expected = expected->substr(result.window, same + mismatch_context_);
+        }
 
-        std::string outstr = tout_.str();
-        std::string errstr = terr_.str();
-        entry.output = outstr;
-        if(expected_output_)
-            entry.output_expected = *expected_output_;
-        entry.error = errstr;
-        if(expected_error_)
-            entry.error_expected = *expected_error_;
-        entry.result = entry.result && (!expected_output_ || *expected_output_ == outstr) && (!expected_error_ || *expected_error_ == errstr);
+        if(!result.Matches())
+            comparison = result;
+        return result.Matches();
     }
 };
 
@@ -102,6 +144,22 @@ private:
     template<typename ReturnT, typename... Args> \
     class GCHECK_TEST_##suitename##_##testname : public gcheck::IOTest<ReturnT, Args...> { \
         using gcheck::FunctionTest<ReturnT, Args...>::SetTimeout; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSafeBatchSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCPUTime; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxMemory; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxFileSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxProcesses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetBenchmark; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetComplexity; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetPerfCounters; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxInstructions; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCycles; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCacheMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxBranchMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetTrackAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxPeakBytes; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArguments; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArgumentsAfter; \
         using gcheck::FunctionTest<ReturnT, Args...>::IgnoreArgumentsAfter; \
@@ -112,8 +170,10 @@ private:
         using gcheck::FunctionTest<ReturnT, Args...>::AddPostRun; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetMaxRunTime; \
         using gcheck::IOTest<ReturnT, Args...>::SetInput; \
+        using gcheck::IOTest<ReturnT, Args...>::SetInputFile; \
         using gcheck::IOTest<ReturnT, Args...>::SetOutput; \
         using gcheck::IOTest<ReturnT, Args...>::SetError; \
+        using gcheck::IOTest<ReturnT, Args...>::SetOutputLimit; \
         using gcheck::Test::OutputFormat; \
         using gcheck::Test::SetGradingMethod; \
         void SetInputsAndOutputs(); \
@@ -129,6 +189,22 @@ private:
     template<typename ReturnT, typename... Args> \
     class GCHECK_TEST_##suitename##_##testname : public gcheck::IOTest<ReturnT, Args...> { \
         using gcheck::FunctionTest<ReturnT, Args...>::SetTimeout; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSafeBatchSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCPUTime; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxMemory; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxFileSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxProcesses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetBenchmark; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetComplexity; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetPerfCounters; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxInstructions; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCycles; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCacheMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxBranchMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetTrackAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxPeakBytes; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArguments; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArgumentsAfter; \
         using gcheck::FunctionTest<ReturnT, Args...>::IgnoreArgumentsAfter; \
@@ -139,8 +215,10 @@ private:
         using gcheck::FunctionTest<ReturnT, Args...>::AddPostRun; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetMaxRunTime; \
         using gcheck::IOTest<ReturnT, Args...>::SetInput; \
+        using gcheck::IOTest<ReturnT, Args...>::SetInputFile; \
         using gcheck::IOTest<ReturnT, Args...>::SetOutput; \
         using gcheck::IOTest<ReturnT, Args...>::SetError; \
+        using gcheck::IOTest<ReturnT, Args...>::SetOutputLimit; \
         using gcheck::Test::OutputFormat; \
         using gcheck::Test::SetGradingMethod; \
         void SetInputsAndOutputs(); \
@@ -5,11 +5,14 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <tuple>
 #include <map>
+#include <type_traits>
 
 #include "sfinae.h"
+#include "message_pack.h"
 
 namespace gcheck {
 
@@ -44,6 +47,14 @@ template<template<typename> class allocator>
 class _UserObject;
 
 enum ForkStatus : unsigned int;
+struct ResourceUsage;
+struct RunTimeStats;
+enum RunTimeStatistic : int;
+enum Complexity : int;
+struct ComplexityFit;
+struct PerfCounters;
+struct AllocationStats;
+struct OutputComparison;
 
 class Prerequisite;
 
@@ -57,173 +68,226 @@ public:
     _JSON(const _JSON<T>& json) : string(json) {}
 };
 
-template<>
-class _JSON<std::allocator> : public std::string {
-    typedef std::string string;
+/*
+    Appends JSON to a single buffer, so nested values are written in one pass instead of being converted to strings
+    at each level. Commas between the items of arrays and objects are added automatically.
+    With the MessagePack encoding the same values are written as MessagePack instead. The lengths of arrays and maps
+    aren't known when they are opened, so they always get 32 bit lengths that are filled in when they are closed.
+*/
+class JsonWriter {
 public:
-    _JSON() : string("null") {}
-    _JSON(const _JSON& json) = default;
-    template<template<typename> class T>
-    _JSON(const _JSON<T>& json) : string(json) {}
-    _JSON(const std::string& str) : string("\"" + Escape(str) + "\"") {}
-    _JSON(const char* str);
-    _JSON(const std::string& key, const _JSON& value) : string(_JSON(key) + ":" + value) {}
-    _JSON(const std::string& key, const char* value) : _JSON(key, _JSON(value)) {}
-    _JSON(bool b) : string(b ? "true" : "false") {}
-
-    _JSON(const _TestReport<std::allocator>& r);
-    _JSON(const _CaseEntry<std::allocator>& e);
-    _JSON(const _FunctionEntry<std::allocator>& e);
-    _JSON(const _TestData<std::allocator>& data);
-    _JSON(const _UserObject<std::allocator>& o);
-    _JSON(const TestStatus& status);
-    _JSON(const Prerequisite& o);
-    _JSON(const ForkStatus& s);
-
-    template<typename T, typename SFINAE = typename std::enable_if_t<!has_tojson<T>::value && !has_tostring<T>::value && !has_std_tostring<T>::value>, typename A = SFINAE, typename A2 = SFINAE, typename A3 = SFINAE>
-    _JSON(const T&) : _JSON() {}
-
-    template<typename T, typename SFINAE = typename std::enable_if_t<!has_tojson<T>::value && !has_tostring<T>::value && has_std_tostring<T>::value>, typename A = SFINAE, typename A2 = SFINAE>
-    _JSON(const T& value) : string(std::to_string(value)) {}
+    enum Encoding {
+        Text,
+        MessagePack
+    };
+
+    JsonWriter(std::string& out, Encoding encoding = Text) : out_(out), encoding_(encoding), first_(encoding == Text) {}
+
+    JsonWriter& BeginObject() { return Open('{'); }
+    JsonWriter& EndObject() { return Close('}'); }
+    JsonWriter& BeginArray() { return Open('['); }
+    JsonWriter& EndArray() { return Close(']'); }
+
+    // Starts a member of an object, the next value written is its value
+    JsonWriter& Key(std::string_view key);
+    // Escapes and quotes 'str'
+    JsonWriter& String(std::string_view str);
+    // Writes already serialized JSON as is, or transcoded to MessagePack
+    JsonWriter& Raw(std::string_view json) {
+        Separate();
+        if(encoding_ == MessagePack)
+            AppendMessagePack(json, out_);
+        else
+            out_ += json;
+        return *this;
+    }
+    JsonWriter& Null() {
+        if(encoding_ == Text)
+            return Raw("null");
+        Separate();
+        MessagePackEncoder(out_).Nil();
+        return *this;
+    }
+    // Numbers are written with std::to_string in JSON
+    template<typename T>
+    JsonWriter& Number(T value) {
+        if(encoding_ == Text)
+            return Raw(std::to_string(value));
+        Separate();
+        if constexpr(std::is_floating_point_v<T>)
+            MessagePackEncoder(out_).Float(value);
+        else if constexpr(std::is_signed_v<T>)
+            MessagePackEncoder(out_).Int(value);
+        else
+            MessagePackEncoder(out_).UInt(value);
+        return *this;
+    }
 
-    template<typename T, typename SFINAE = typename std::enable_if_t<!has_tojson<T>::value && has_tostring<T>::value>, typename A = SFINAE>
-    _JSON(const T& value) : _JSON(to_string(value)) {}
+    Encoding GetEncoding() const { return encoding_; }
 
-    template<typename T, typename = typename std::enable_if_t<has_tojson<T>::value>>
-    _JSON(const T& value) : string(to_json(value)) {}
+    template<typename T>
+    JsonWriter& Member(std::string_view key, const T& value) { return Key(key).Value(value); }
+
+    JsonWriter& Value(const std::string& str) { return String(str); }
+    JsonWriter& Value(const char* str) { return String(str); }
+    JsonWriter& Value(bool b) {
+        if(encoding_ == Text)
+            return Raw(b ? "true" : "false");
+        Separate();
+        MessagePackEncoder(out_).Bool(b);
+        return *this;
+    }
+    template<template<typename> class allocator>
+    JsonWriter& Value(const _JSON<allocator>& json) { return Raw(json); }
+
+    JsonWriter& Value(const _TestReport<std::allocator>& r);
+    JsonWriter& Value(const _CaseEntry<std::allocator>& e);
+    JsonWriter& Value(const _FunctionEntry<std::allocator>& e);
+    JsonWriter& Value(const _TestData<std::allocator>& data);
+    JsonWriter& Value(const _UserObject<std::allocator>& o);
+    JsonWriter& Value(const TestStatus& status);
+    JsonWriter& Value(const Prerequisite& o);
+    JsonWriter& Value(const ForkStatus& s);
+    JsonWriter& Value(const ResourceUsage& u);
+    JsonWriter& Value(const RunTimeStats& s);
+    JsonWriter& Value(const RunTimeStatistic& s);
+    JsonWriter& Value(const Complexity& c);
+    JsonWriter& Value(const ComplexityFit& f);
+    JsonWriter& Value(const PerfCounters& c);
+    JsonWriter& Value(const AllocationStats& s);
+    JsonWriter& Value(const OutputComparison& c);
 
     template<typename T>
-    _JSON(const std::string& key, const T& value) : string("\"" + key + "\":" + _JSON(value)) {}
+    JsonWriter& Value(const T& value) {
+        if constexpr(std::is_arithmetic_v<T> && has_std_tostring<T>::value && !has_tojson<T>::value && !has_tostring<T>::value)
+            return Number(value);
+        else if constexpr(has_tojson<T>::value)
+            return Raw(to_json(value));
+        else if constexpr(has_tostring<T>::value)
+            return String(to_string(value));
+        else if constexpr(has_std_tostring<T>::value)
+            return Raw(std::to_string(value));
+        else
+            return Null();
+    }
 
     template<template<typename...> class C, typename... Args, class = std::enable_if_t<has_begin_end<C<Args...>>::value>>
-    _JSON(const C<Args...>& c) {
-        std::string ret = "[";
-        for(auto it = c.begin(); it != c.end();) {
-            ret += _JSON(*it);
-            if(++it != c.end())
-                ret += ",";
-        }
-        ret += "]";
-
-        Set(ret);
+    JsonWriter& Value(const C<Args...>& c) {
+        BeginArray();
+        for(const auto& item : c)
+            Value(item);
+        return EndArray();
     }
 
     template<template<typename...> class C, typename... Args, class = std::enable_if_t<has_begin_end<C<std::pair<std::string, Args...>>>::value>>
-    _JSON(const C<std::pair<std::string, Args...>>& c) {
-        std::string ret = "{";
+    JsonWriter& Value(const C<std::pair<std::string, Args...>>& c) { return Members(c); }
 
-        for(auto it = c.begin(); it != c.end();) {
-            ret += _JSON(it->first, it->second);
-            if(++it != c.end())
-                ret += ",";
-        }
-        ret += "}";
+    template<typename T>
+    JsonWriter& Value(const std::vector<std::pair<std::string, T>>& v) { return Members(v); }
 
-        Set(ret);
-    }
+    template<typename T>
+    JsonWriter& Value(const std::vector<std::pair<const char*, T>>& v) { return Members(v); }
 
     template<typename T>
-    _JSON(const std::vector<T>& v) {
-        std::string ret = "[";
-        for(auto it = v.begin(); it != v.end();) {
-            ret += _JSON(*it);
-            if(++it != v.end())
-                ret += ",";
-        }
-        ret += "]";
+    JsonWriter& Value(const std::map<std::string, T>& m) { return Members(m); }
 
-        Set(ret);
+    template<typename... Args>
+    JsonWriter& Value(const std::tuple<Args...>& t) {
+        BeginArray();
+        std::apply([this](const auto&... items) { (Value(items), ...); }, t);
+        return EndArray();
     }
 
-    template<typename T>
-    _JSON(const std::vector<std::pair<std::string, T>>& v) {
-        std::string ret = "{";
-
-        for(auto it = v.begin(); it != v.end();) {
-            ret += _JSON(it->first, it->second);
-            if(++it != v.end())
-                ret += ",";
-        }
-        ret += "}";
+    JsonWriter& Value(const std::tuple<>&) { return BeginArray().EndArray(); }
 
-        Set(ret);
+    template<typename... Args>
+    JsonWriter& Value(const std::tuple<std::pair<std::string, Args>...>& t) {
+        BeginObject();
+        std::apply([this](const auto&... items) { (Member(items.first, items.second), ...); }, t);
+        return EndObject();
     }
 
-    template<typename T>
-    _JSON(const std::vector<std::pair<const char*, T>>& v) {
-        std::string ret = "{";
+    template<typename... Args>
+    JsonWriter& Value(const std::tuple<std::pair<const char*, Args>...>& t) {
+        BeginObject();
+        std::apply([this](const auto&... items) { (Member(items.first, items.second), ...); }, t);
+        return EndObject();
+    }
 
-        for(auto it = v.begin(); it != v.end();) {
-            ret += _JSON(it->first, it->second);
-            if(++it != v.end())
-                ret += ",";
+private:
+    JsonWriter& Open(char bracket) {
+        Separate();
+        if(encoding_ == MessagePack) {
+            out_ += (char)(bracket == '{' ? 0xDF : 0xDD);
+            lengths_.push_back({out_.size(), 0});
+            out_.append(4, '\0');
+            return *this;
         }
-        ret += "}";
-
-        Set(ret);
+        out_ += bracket;
+        first_ = true;
+        return *this;
     }
-
-
-    template<typename T>
-    _JSON(const std::map<std::string, T>& m) {
-        std::string ret = "{";
-
-        for(auto it = m.begin(); it != m.end();) {
-            ret += _JSON(it->first, it->second);
-            if(++it != m.end())
-                ret += ",";
+    JsonWriter& Close(char bracket) {
+        if(encoding_ == MessagePack) {
+            auto [offset, length] = lengths_.back();
+            lengths_.pop_back();
+            for(size_t i = 0; i < 4; i++)
+                out_[offset + i] = (char)(length >> (8*(3 - i)));
+            return *this;
         }
-        ret += "}";
-
-        Set(ret);
+        out_ += bracket;
+        first_ = false;
+        return *this;
     }
-
-
-    template<typename... Args>
-    _JSON(const std::tuple<Args...>& v) {
-        std::string ret = "[";
-
-        for_each(v, [&ret](int index, const auto& item) {
-            ret += _JSON(item);
-            if(index != sizeof...(Args)-1)
-                ret += ",";
-        });
-        ret += "]";
-
-        Set(ret);
+    // Called before each item. In MessagePack, counts the items of the innermost container instead, a key and its
+    // value being one item.
+    void Separate() {
+        if(encoding_ == MessagePack) {
+            if(first_)
+                first_ = false; // The value of a key
+            else if(!lengths_.empty())
+                lengths_.back().second++;
+            return;
+        }
+        if(!first_)
+            out_ += ',';
+        first_ = false;
     }
 
-    _JSON(const std::tuple<>&) {
-        Set("[]");
+    template<typename C>
+    JsonWriter& Members(const C& c) {
+        BeginObject();
+        for(const auto& [key, value] : c)
+            Member(key, value);
+        return EndObject();
     }
 
-    template<typename... Args>
-    _JSON(const std::tuple<std::pair<std::string, Args>...>& v) {
-        std::string ret = "{";
-
-        for_each(v, [&ret](int index, const auto& item) {
-            ret += _JSON(item.first, item.second);
-            if(index != sizeof...(Args)-1)
-                ret += ",";
-        });
-        ret += "}";
-
-        Set(ret);
-    }
+    std::string& out_;
+    Encoding encoding_;
+    // Whether the next item is the first one of its container, or the value of a key. Only the latter in MessagePack.
+    bool first_;
+    std::vector<std::pair<size_t, uint32_t>> lengths_; // Offsets and lengths of the open MessagePack containers
+};
 
-    template<typename... Args>
-    _JSON(const std::tuple<std::pair<const char*, Args>...>& v) {
-        std::string ret = "{";
+template<>
+class _JSON<std::allocator> : public std::string {
+    typedef std::string string;
+public:
+    _JSON() : string("null") {}
+    _JSON(const _JSON& json) = default;
+    template<template<typename> class T>
+    _JSON(const _JSON<T>& json) : string(json) {}
+    _JSON(const std::string& str) { JsonWriter(*this).String(str); }
+    _JSON(const char* str) { JsonWriter(*this).String(str); }
+    _JSON(bool b) : string(b ? "true" : "false") {}
 
-        for_each(v, [&ret](int index, const auto& item) {
-            ret += _JSON(item.first, item.second);
-            if(index != sizeof...(Args))
-                ret += ",";
-        });
-        ret += "}";
+    // Anything the JsonWriter can write
+    template<typename T>
+    _JSON(const T& value) { JsonWriter(*this).Value(value); }
 
-        Set(ret);
-    }
+    // The member '"key":value' of an object
+    template<typename T>
+    _JSON(const std::string& key, const T& value) { JsonWriter(*this).Member(key, value); }
 
     _JSON& Set(const std::string& str) {
         string::operator=(str);
@@ -0,0 +1,97 @@
+/*
+    Compact binary encoding of the reports. The binary report has the same object model as the JSON one, written
+    as MessagePack, so it can be read with any MessagePack library.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace gcheck {
+
+// Version of the layout of the binary report, stored under "schema_version" at its top level
+constexpr int binary_report_version = 1;
+
+// Appends MessagePack values to 'out' in their shortest forms
+class MessagePackEncoder {
+public:
+    MessagePackEncoder(std::string& out) : out_(out) {}
+
+    void Byte(uint8_t b) { out_ += (char)b; }
+
+    template<typename T>
+    void BigEndian(uint8_t tag, T value) {
+        char bytes[sizeof(T)];
+        for(size_t i = 0; i < sizeof(T); i++)
+            bytes[i] = (char)(value >> (8*(sizeof(T) - 1 - i)));
+        Byte(tag);
+        out_.append(bytes, sizeof(T));
+    }
+
+    void Nil() { Byte(0xC0); }
+    void Bool(bool b) { Byte(b ? 0xC3 : 0xC2); }
+
+    void UInt(uint64_t value) {
+        if(value < 0x80) Byte((uint8_t)value);
+        else if(value <= UINT8_MAX) BigEndian<uint8_t>(0xCC, (uint8_t)value);
+        else if(value <= UINT16_MAX) BigEndian<uint16_t>(0xCD, (uint16_t)value);
+        else if(value <= UINT32_MAX) BigEndian<uint32_t>(0xCE, (uint32_t)value);
+        else BigEndian<uint64_t>(0xCF, value);
+    }
+
+    void Int(int64_t value) {
+        if(value >= 0) UInt((uint64_t)value);
+        else if(value >= -32) Byte((uint8_t)value);
+        else if(value >= INT8_MIN) BigEndian<uint8_t>(0xD0, (uint8_t)value);
+        else if(value >= INT16_MIN) BigEndian<uint16_t>(0xD1, (uint16_t)value);
+        else if(value >= INT32_MIN) BigEndian<uint32_t>(0xD2, (uint32_t)value);
+        else BigEndian<uint64_t>(0xD3, (uint64_t)value);
+    }
+
+    void Float(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        BigEndian<uint64_t>(0xCB, bits);
+    }
+
+    void String(std::string_view str) {
+        size_t size = str.size();
+        if(size < 32) Byte((uint8_t)(0xA0 | size));
+        else if(size <= UINT8_MAX) BigEndian<uint8_t>(0xD9, (uint8_t)size);
+        else if(size <= UINT16_MAX) BigEndian<uint16_t>(0xDA, (uint16_t)size);
+        else BigEndian<uint32_t>(0xDB, (uint32_t)size);
+        out_ += str;
+    }
+
+    void Array(size_t count) {
+        if(count < 16) Byte((uint8_t)(0x90 | count));
+        else if(count <= UINT16_MAX) BigEndian<uint16_t>(0xDC, (uint16_t)count);
+        else BigEndian<uint32_t>(0xDD, (uint32_t)count);
+    }
+
+    void Map(size_t count) {
+        if(count < 16) Byte((uint8_t)(0x80 | count));
+        else if(count <= UINT16_MAX) BigEndian<uint16_t>(0xDE, (uint16_t)count);
+        else BigEndian<uint32_t>(0xDF, (uint32_t)count);
+    }
+private:
+    std::string& out_;
+};
+
+/*
+    Appends a JSON document encoded as MessagePack to 'out'. Integers are encoded as integers and other numbers as
+    doubles. Also accepts the nan and inf that std::to_string produces. Throws std::runtime_error if the JSON is
+    malformed.
+*/
+void AppendMessagePack(std::string_view json, std::string& out);
+
+inline std::string JSONToMessagePack(std::string_view json) {
+    std::string out;
+    AppendMessagePack(json, out);
+    return out;
+}
+
+} // gcheck
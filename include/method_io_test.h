@@ -37,6 +37,22 @@ private:
     template<typename ReturnT, typename ObjectType, typename... Args> \
     class GCHECK_TEST_##suitename##_##testname : public gcheck::MethodIOTest<ReturnT, ObjectType, Args...> { \
         using gcheck::FunctionTest<ReturnT, Args...>::SetTimeout; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSafeBatchSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCPUTime; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxMemory; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxFileSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxProcesses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetBenchmark; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetComplexity; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetPerfCounters; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxInstructions; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCycles; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCacheMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxBranchMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetTrackAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxPeakBytes; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArguments; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArgumentsAfter; \
         using gcheck::FunctionTest<ReturnT, Args...>::IgnoreArgumentsAfter; \
@@ -48,8 +64,10 @@ private:
         using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetObjectAfter; \
         using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetStateComparer; \
         using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetInput; \
+        using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetInputFile; \
         using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetOutput; \
         using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetError; \
+        using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetOutputLimit; \
         using gcheck::Test::OutputFormat; \
         using gcheck::Test::SetGradingMethod; \
         void SetInputsAndOutputs(); \
@@ -69,6 +87,22 @@ private:
     template<typename ReturnT, typename ObjectType, typename... Args> \
     class GCHECK_TEST_##suitename##_##testname : public gcheck::MethodIOTest<ReturnT, ObjectType, Args...> { \
         using gcheck::FunctionTest<ReturnT, Args...>::SetTimeout; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSafeBatchSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCPUTime; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxMemory; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxFileSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxProcesses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetBenchmark; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetComplexity; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetSize; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetPerfCounters; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxInstructions; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCycles; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxCacheMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxBranchMisses; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetTrackAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxAllocations; \
+        using gcheck::FunctionTest<ReturnT, Args...>::SetMaxPeakBytes; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArguments; \
         using gcheck::FunctionTest<ReturnT, Args...>::SetArgumentsAfter; \
         using gcheck::FunctionTest<ReturnT, Args...>::IgnoreArgumentsAfter; \
@@ -80,8 +114,10 @@ private:
         using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetObjectAfter; \
         using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetStateComparer; \
         using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetInput; \
+        using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetInputFile; \
         using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetOutput; \
         using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetError; \
+        using gcheck::MethodIOTest<ReturnT, ObjectType, Args...>::SetOutputLimit; \
         using gcheck::Test::OutputFormat; \
         using gcheck::Test::SetGradingMethod; \
         void SetInputsAndOutputs(); \
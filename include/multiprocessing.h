@@ -2,7 +2,19 @@
 
 #include <chrono>
 #include <iostream>
+#include <functional>
+#include <vector>
+#include <map>
+#include <optional>
+#include <utility>
+#if !defined(_WIN32) && !defined(WIN32)
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <signal.h>
+    #include <unistd.h>
+#endif
 #include "shared_allocator.h"
+#include "flat.h"
 
 namespace gcheck {
 
@@ -12,40 +24,269 @@ enum ForkStatus : unsigned int {
     ERROR
 };
 
+/*
+    Limits for the forked processes that run tests. They are set as soft limits with setrlimit,
+    so going over them kills the process (or makes the allocation or write fail). Unset limits aren't changed.
+*/
+struct ResourceLimits {
+    std::optional<double> cpu_time; // Seconds of CPU time counted from when the limits are applied
+    std::optional<size_t> memory; // Bytes of heap and other private memory (RLIMIT_DATA)
+    std::optional<size_t> file_size; // Bytes a written file may grow to
+    std::optional<size_t> processes; // Number of processes the user may have, including the existing ones
+
+    bool Empty() const { return !cpu_time && !memory && !file_size && !processes; }
+    // Applies the limits to this process. Throws std::runtime_error if a limit can't be set.
+    void Apply() const;
+};
+
+// Resources used by a process, or by a part of its run for differences of two measurements
+struct ResourceUsage {
+    std::chrono::duration<double> user_time = std::chrono::duration<double>::zero();
+    std::chrono::duration<double> system_time = std::chrono::duration<double>::zero();
+    long max_rss = 0; // Peak resident set size of the process in kilobytes
+    long minor_faults = 0;
+    long major_faults = 0;
+    long voluntary_switches = 0;
+    long involuntary_switches = 0;
+
+    // Usage of this process so far
+    static ResourceUsage Self();
+    // Usage since 'earlier'. max_rss is kept as the peak of the process.
+    ResourceUsage operator-(const ResourceUsage& earlier) const;
+};
+
 #if defined(__linux__)
+/*
+    Waits for forked children. Each child gets an absolute deadline when it is added, so waking up for other
+    children or signals doesn't extend it. Children are watched with pidfds, so the signal mask isn't touched and
+    unrelated children of the process are left alone.
+*/
+class ChildSupervisor {
+public:
+    struct Exit {
+        pid_t pid;
+        ForkStatus status; // OK if the child exited with 0, TIMEDOUT if it was killed at its deadline, ERROR otherwise
+        int wait_status; // Status given by waitpid
+        ResourceUsage usage; // Resources used by the child and its waited for children
+    };
+
+    ChildSupervisor() {}
+    ChildSupervisor(const ChildSupervisor&) = delete;
+    // Kills and reaps the children that haven't been waited for
+    ~ChildSupervisor();
+
+    // Zero timeout means no deadline
+    void Add(pid_t pid, std::chrono::duration<double> timeout);
+    // Waits until a child exits or passes its deadline, in which case it is killed. There must be children left.
+    Exit Wait();
+
+    bool Empty() const { return children_.empty(); }
+    size_t Size() const { return children_.size(); }
+private:
+    struct Child {
+        int fd; // -1 if pidfds aren't supported, then the child is polled with waitpid
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+    };
+    Exit Reap(pid_t pid, bool timed_out);
+
+    std::map<pid_t, Child> children_;
+};
+
+// Describes how a child ended from the status given by waitpid, e.g. "killed by signal 6 (Aborted)"
+std::string DescribeExit(int wait_status);
+
+// Waits for the child pid for at most time and kills it if it doesn't finish
 ForkStatus wait_timeout(pid_t pid, std::chrono::duration<double> time);
 
-template<template<template<typename...> class> class T, typename F, typename... Args>
-ForkStatus RunForked(std::chrono::duration<double> timeout, T<std::allocator>& data_out, size_t mem_size, F&& function, Args&&... args) {
-    shared_manager sm;
-    shared_manager::manager = &sm;
-    sm.Realloc(mem_size);
+// Waits for the child pid to exit. Returns the status given by waitpid and stores the resources it used to usage_out.
+int wait_usage(pid_t pid, ResourceUsage& usage_out);
 
+// Writes data in the flat form to the start of the memory of sm
+template<typename T>
+void WriteFlat(shared_manager& sm, const T& data) {
+    FlatWriter writer(sm.Memory(), sm.Size());
+    Flatten(writer, data);
+}
+
+// Reads data written by WriteFlat from the memory of sm
+template<typename T>
+void ReadFlat(shared_manager& sm, T& data_out) {
+    FlatReader reader(sm.Memory(), sm.Size());
+    Unflatten(reader, data_out);
+}
+
+/*
+    Forks a child that calls function(args...) and then writes data to the memory of sm.
+    Returns the pid of the child without waiting for it. Use FinishForked to collect the results.
+*/
+template<typename T, typename F, typename... Args>
+pid_t StartForked(shared_manager& sm, const T& data, F&& function, Args&&... args) {
     pid_t pid = fork();
     if(pid == 0) {
-        auto allocator = shared_allocator<T<shared_allocator>>();
-        auto data = allocator.allocate(1);
+        function(std::forward<Args>(args)...);
+        WriteFlat(sm, data);
+        exit(0);
+    }
+    return pid;
+}
+
+/*
+    Copies the results of a child started with StartForked to data_out.
+    'status' is the status given by waitpid for the child.
+*/
+template<typename T>
+ForkStatus FinishForked(shared_manager& sm, int status, T& data_out) {
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return ERROR;
 
+    ReadFlat(sm, data_out);
+    return OK;
+}
+
+/*
+    Runs function(args...) in a forked child with limits applied and copies data_out from it afterwards.
+    The resources used by the child are stored to usage_out, also when it crashes or times out.
+*/
+template<typename T, typename F, typename... Args>
+ForkStatus RunForkedLimited(std::chrono::duration<double> timeout, const ResourceLimits& limits, ResourceUsage& usage_out, T& data_out, F&& function, Args&&... args) {
+    shared_manager sm(shared_manager::limit_);
+
+    pid_t pid = StartForked(sm, data_out, [&]() {
+        limits.Apply();
         function(std::forward<Args>(args)...);
+    });
+    if(pid < 0)
+        return ERROR;
 
-        allocator.construct(data, data_out);
+    ChildSupervisor supervisor;
+    supervisor.Add(pid, timeout);
+    auto exit = supervisor.Wait();
+    usage_out = exit.usage;
+    if(exit.status == TIMEDOUT)
+        return TIMEDOUT;
+    return FinishForked(sm, exit.wait_status, data_out);
+}
+
+template<typename T, typename F, typename... Args>
+ForkStatus RunForked(std::chrono::duration<double> timeout, T& data_out, F&& function, Args&&... args) {
+    ResourceUsage usage;
+    return RunForkedLimited(timeout, ResourceLimits(), usage, data_out, std::forward<F>(function), std::forward<Args>(args)...);
+}
+
+// Waits until fd is readable or the timeout passes. Zero timeout waits indefinitely. Returns false on timeout.
+bool wait_readable(int fd, std::chrono::duration<double> timeout);
+
+/*
+    Runs function(index) for each index in [begin, end) in one forked child. After each index the child copies
+    data[index] to shared memory and reports it over a pipe, so the finished indices are kept if the child
+    crashes or times out. The timeout applies to each index separately.
+    Returns the number of finished indices and the status of the index that didn't finish (OK if all finished).
+    The resources the child used after the last finished index are stored to usage_out.
+*/
+template<typename T, typename F>
+std::pair<size_t, ForkStatus> RunForkedBatch(std::chrono::duration<double> timeout, std::vector<T>& data, size_t begin, size_t end, ResourceUsage& usage_out, F&& function) {
+    shared_manager sm(shared_manager::limit_);
+
+    int fds[2];
+    if(pipe(fds) != 0)
+        return {0, ERROR};
+
+    // Offsets of the entries from the start of the memory. The entries are written after these.
+    size_t* offsets = (size_t*)sm.Memory();
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        close(fds[0]);
+        size_t offset = (end-begin)*sizeof(size_t);
+
+        for(size_t index = begin; index < end; index++) {
+            function(index);
+
+            FlatWriter writer((char*)sm.Memory() + offset, sm.Size() - offset);
+            Flatten(writer, data[index]);
+            offsets[index-begin] = offset;
+            offset += writer.Size();
+
+            // The usage so far tells the parent what the next index used if it doesn't finish
+            ResourceUsage usage = ResourceUsage::Self();
+            if(write(fds[1], &usage, sizeof(usage)) != sizeof(usage))
+                break;
+        }
         exit(0);
-    } else if(timeout != timeout.zero()) {
-        ForkStatus status = wait_timeout(pid, timeout);
-        if(status == TIMEDOUT || status == ERROR) {
-            return status;
+    }
+    close(fds[1]);
+    if(pid < 0) {
+        close(fds[0]);
+        return {0, ERROR};
+    }
+
+    size_t finished = 0;
+    ForkStatus status = OK;
+    ResourceUsage reported;
+    while(finished != end-begin) {
+        if(!wait_readable(fds[0], timeout)) {
+            kill(pid, SIGKILL);
+            status = TIMEDOUT;
+            break;
+        }
+        if(read(fds[0], &reported, sizeof(reported)) != sizeof(reported)) {
+            status = ERROR;
+            break;
         }
-    } else {
-        int status;
-        waitpid(pid, &status, WUNTRACED);
-        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
-            return ERROR;
+        finished++;
     }
-    (void)timeout;
+    close(fds[0]);
 
-    data_out = *(T<shared_allocator>*)sm.Memory();
-    return OK;
+    ResourceUsage usage;
+    int exit_status = wait_usage(pid, usage);
+    usage_out = usage - reported;
+    if(status == OK && (!WIFEXITED(exit_status) || WEXITSTATUS(exit_status) != 0))
+        status = ERROR;
+
+    for(size_t i = 0; i < finished; i++) {
+        FlatReader reader((char*)sm.Memory() + offsets[i], sm.Size() - offsets[i]);
+        Unflatten(reader, data[begin+i]);
+    }
+
+    return {finished, finished == end-begin ? OK : status};
 }
+
+/*
+    A forked worker process that runs requests sent to it over a pipe, so that a fork isn't needed for each request.
+    The handler gets the request and the shared memory to write its results to, e.g. with WriteFlat.
+    The worker is killed on timeouts and is started again for the next request after it has crashed or timed out.
+*/
+class ForkServer {
+public:
+    ForkServer(std::function<void(size_t, shared_manager&)> handler);
+    ForkServer(const ForkServer&) = delete;
+    ~ForkServer();
+
+    bool IsRunning() const { return pid_ > 0; }
+    // Forks the worker. The worker gets the state of this process at the time of the call.
+    void Start();
+    // Stops the worker after it has finished its current request
+    void Stop();
+    /* Runs handler(request) in the worker, starting it first if it isn't running. The resources the worker used for
+    the request are stored to usage_out, also when it crashes or times out. */
+    ForkStatus Run(size_t request, std::chrono::duration<double> timeout, ResourceUsage& usage_out);
+
+    shared_manager& Memory() { return memory_; }
+private:
+    // Waits for the worker to exit and returns the resources it used
+    ResourceUsage Reap();
+    ResourceUsage Kill();
+
+    shared_manager memory_;
+    std::function<void(size_t, shared_manager&)> handler_;
+    pid_t pid_ = -1;
+    int request_fd_ = -1;
+    int response_fd_ = -1;
+    ResourceUsage reported_; // Usage of the worker when it finished its last request
+};
 #endif
 
-} // gcheck
\ No newline at end of file
+} // gcheck
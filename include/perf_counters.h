@@ -0,0 +1,61 @@
+/*
+    Hardware performance counters of the tested function calls.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <cstdint>
+#include <vector>
+#include <utility>
+
+namespace gcheck {
+
+/*
+    Counts of events during a call. The hardware counters are unset if they couldn't be opened, e.g. in a
+    virtual machine or when perf_event_paranoid forbids them. The task clock is always set; it falls back
+    to the CPU clock of the thread when perf events are unavailable altogether.
+    The same struct is used for the limits of the counts, where unset means no limit.
+*/
+struct PerfCounters {
+    std::optional<uint64_t> instructions;
+    std::optional<uint64_t> cycles;
+    std::optional<uint64_t> cache_misses;
+    std::optional<uint64_t> branch_misses;
+    std::optional<std::chrono::nanoseconds> task_clock;
+
+    bool Empty() const { return !instructions && !cycles && !cache_misses && !branch_misses && !task_clock; }
+    // Whether the available counts are within the limits. Limits of unavailable counters aren't checked.
+    bool IsWithin(const PerfCounters& limits) const;
+};
+
+/*
+    The counters of the calling thread. The counters are opened on the first Start in each process, so that
+    a forked child counts its own events instead of the parent's.
+*/
+class PerfCounterGroup {
+public:
+    PerfCounterGroup() {}
+    PerfCounterGroup(const PerfCounterGroup&) = delete;
+    PerfCounterGroup& operator=(const PerfCounterGroup&) = delete;
+    ~PerfCounterGroup();
+
+    // Resets and starts the counters
+    void Start();
+    // Stops the counters and returns the counts since Start
+    PerfCounters Stop();
+private:
+    enum Counter { Instructions, Cycles, CacheMisses, BranchMisses, NumCounters };
+
+    void Open();
+    void Close();
+
+    long pid_ = 0; // The process the counters were opened in
+    int leader_ = -1; // Group leader, the first hardware counter that could be opened
+    std::vector<std::pair<Counter, int>> counters_; // Opened hardware counters in the order of the group
+    int task_clock_ = -1;
+    std::chrono::nanoseconds thread_time_ = std::chrono::nanoseconds::zero(); // Fallback for task_clock_
+};
+
+} // gcheck
@@ -0,0 +1,128 @@
+/*
+    Counter-based random numbers for the random arguments. A value is a hash of the key of its stream and of its
+    position in the stream, so any stream can be regenerated from its key alone, without generating what came
+    before it and in any process.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace gcheck {
+
+// The finalizer of SplitMix64, a bijective mix of the bits of x
+constexpr uint64_t MixBits(uint64_t x) {
+    x = (x ^ (x >> 30))*0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27))*0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// The high 64 bits of the 128 bit product of a and b
+inline uint64_t MultiplyHigh(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 uint128_t;
+    return (uint64_t)(((uint128_t)a*b) >> 64);
+#else
+    uint64_t a_low = a & 0xFFFFFFFF, a_high = a >> 32;
+    uint64_t b_low = b & 0xFFFFFFFF, b_high = b >> 32;
+    uint64_t low = a_low*b_low;
+    uint64_t middle1 = a_high*b_low + (low >> 32);
+    uint64_t middle2 = a_low*b_high + (middle1 & 0xFFFFFFFF);
+    return a_high*b_high + (middle1 >> 32) + (middle2 >> 32);
+#endif
+}
+
+// A key for 'value' under 'key'. Keys made from different values are unrelated.
+constexpr uint64_t MixKey(uint64_t key, uint64_t value) {
+    return MixBits(key ^ MixBits(value + 0x9E3779B97F4A7C15ull));
+}
+
+/*
+    A random number engine for the standard distributions. Value n of the stream is the SplitMix64 output for the
+    state key + n*gamma, so the engine can be moved to any position of its stream in constant time.
+*/
+class RandomEngine {
+public:
+    typedef uint64_t result_type;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    explicit RandomEngine(uint64_t key = 0) : key_(key) {}
+
+    result_type operator()() { return MixBits(key_ + ++position_*gamma); }
+    // The next 'count' values
+    void Fill(result_type* out, size_t count) {
+        for(size_t i = 0; i < count; i++)
+            out[i] = MixBits(key_ + (position_ + 1 + i)*gamma);
+        position_ += count;
+    }
+
+    // An engine for the item 'index' of whatever this engine is for, independent of this one
+    RandomEngine Split(uint64_t index) const { return RandomEngine(MixKey(key_, index)); }
+
+    uint64_t Key() const { return key_; }
+    // The number of values generated
+    uint64_t Position() const { return position_; }
+    void Seek(uint64_t position) { position_ = position; }
+private:
+    static constexpr uint64_t gamma = 0x9E3779B97F4A7C15ull;
+
+    uint64_t key_;
+    uint64_t position_ = 0;
+};
+
+/*
+    The seed of all the random arguments. Chosen at random when first needed unless set with --seed, and saved to
+    the reports, so that the arguments of a run can be generated again.
+*/
+uint64_t GetRandomSeed();
+void SetRandomSeed(uint64_t seed);
+
+// Sets the test and the run that the random arguments are drawn for. The tests call this before each run.
+void SetRandomRun(const std::string& suite, const std::string& test, size_t run_index);
+
+/*
+    The engine of a distribution. The stream is keyed by the seed, the current test and run, and where the stream was
+    created: the test and run then and how many streams were created before it in that run. It starts over whenever
+    the run changes, so the values of a run depend neither on the earlier runs nor on which process draws them.
+    A stream with a seed of its own draws the same values each time the program is run, regardless of the runs.
+*/
+class RandomStream {
+public:
+    typedef uint64_t result_type;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    RandomStream();
+    explicit RandomStream(uint64_t seed) : engine_(MixKey(seed, 0)), origin_(0), generation_(fixed) {}
+
+    result_type operator()() {
+        if(generation_ != fixed && generation_ != generation_now_)
+            Rekey();
+        return engine_();
+    }
+    void Fill(result_type* out, size_t count) {
+        if(generation_ != fixed && generation_ != generation_now_)
+            Rekey();
+        engine_.Fill(out, count);
+    }
+private:
+    friend void SetRandomSeed(uint64_t seed);
+    friend void SetRandomRun(const std::string& suite, const std::string& test, size_t run_index);
+
+    static constexpr uint64_t fixed = UINT64_MAX;
+    // Changes when the run or the seed changes
+    static uint64_t generation_now_;
+
+    void Rekey();
+
+    RandomEngine engine_;
+    uint64_t origin_; // Key of where the stream was created
+    uint64_t generation_; // Of the run the engine is keyed for
+};
+
+} // gcheck
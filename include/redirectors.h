@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <optional>
+#include <thread>
 #include <stdio.h>
 #include <ios>
 
@@ -9,13 +12,18 @@ namespace gcheck {
 /*
     Class for injecting input from a file (e.g. stdin).
     State of associate istream gets reset back to the original after Restore().
+    Written input goes through a pipe. What doesn't fit into the pipe is written by a thread while the input is
+        read, so inputs of any size can be written before the reading starts.
 */
 class FileInjecter {
     bool swapped_;
     bool closed_;
+    bool from_file_; // Injecting a file opened with Open() instead of a pipe
     int save_;
     FILE* original_;
-    FILE* out_;
+    int out_;
+    int in_;
+    std::thread writer_; // Writes the input that didn't fit into the pipe, after the earlier writers finish
     std::istream* associate_;
     std::ios_base::iostate original_state_;
 public:
@@ -32,6 +40,11 @@ public:
     FileInjecter& Capture();
     FileInjecter& Restore();
     FileInjecter& Close();
+    /*
+        Injects the contents of the file at 'path'. The file is read directly, so it isn't loaded into memory first.
+        The input ends at the end of the file. Throws std::runtime_error if the file can't be opened.
+    */
+    FileInjecter& Open(const std::string& path);
 
     FileInjecter& operator<<(std::string str) { return Write(str); }
 };
@@ -47,16 +60,46 @@ public:
 };
 
 
+/*
+    Result of comparing captured output to the expected output while it was being written.
+*/
+struct OutputComparison {
+    size_t size = 0; // Bytes written, including the ones past the limit
+    std::optional<size_t> mismatch; // Offset of the first byte that differs from the expected output
+    bool truncated = false; // More than the limit was written
+    size_t window = 0; // Offset where the reported windows of the output and the expected output start
+
+    bool Matches() const { return !mismatch && !truncated; }
+};
+
 /*
     Class for capturing output written to a file (e.g. stdout).
+    The output is written to an anonymous in-memory file (memfd) where available, otherwise to a tmpfile().
+    Captured output is read through a mapping of the file, or with a single bulk read when it can't be mapped.
 */
 class FileCapturer {
     bool is_swapped_;
     long last_pos_;
     int fileno_;
     int save_;
-    FILE* new_;
+    int fd_; // The file the output is redirected to
+    FILE* new_; // Set if fd_ is from tmpfile()
     FILE* original_;
+    char* mapping_;
+    size_t mapped_size_;
+    std::string buffer_; // Holds the output when the file can't be mapped
+
+    // Streaming: the output goes through a pipe that a thread drains, compares and writes to fd_
+    bool stream_;
+    std::optional<std::string_view> expected_;
+    size_t limit_;
+    size_t context_;
+    int pipe_;
+    std::thread pump_;
+    OutputComparison comparison_;
+
+    void Unmap();
+    void Pump();
 public:
     /*
         Captures output to 'stream'.
@@ -66,9 +109,28 @@ public:
     FileCapturer(FILE* stream, bool capture = true);
     ~FileCapturer();
 
-    std::string str();
+    /*
+        Output written since the last call to str() or view(), or since Capture() if neither has been called.
+        The view is valid until the next call to view(), str() or Capture(), or until the capturer is destroyed.
+    */
+    std::string_view view();
+    std::string str() { return std::string(view()); }
     FileCapturer& Restore();
     FileCapturer& Capture();
+
+    /*
+        Makes the following captures compare the output to 'expected' while it's being written, instead of keeping
+            all of it. 'expected' has to stay valid until Restore(). Only the first 'context' bytes starting from
+            the first mismatch are kept for view(). The comparison stops at the first mismatch.
+        Without 'expected' the output is kept as usual, but only up to 'limit' bytes.
+        Output past the limit, or past the expected output if it's longer, is discarded and marks the comparison
+            as truncated, so that a runaway printing loop can't fill memory or disk before it's stopped.
+    */
+    FileCapturer& Stream(std::optional<std::string_view> expected, size_t limit, size_t context = 0);
+    // Makes the following captures keep all of the output without comparing it
+    FileCapturer& StopStreaming();
+    // Result of the last streamed capture, complete after Restore()
+    const OutputComparison& Comparison() const { return comparison_; }
 };
 
 /*
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <functional>
 #include <vector>
 #include <tuple>
@@ -45,7 +46,9 @@ constexpr auto type_name() noexcept {
 }
 
 // Escape non-utf8 characters and special characters e.g. \n and \t
-std::string JSONEscape(std::string);
+std::string JSONEscape(std::string_view str);
+// Appends the escaped 'str' to 'out'
+void JSONEscape(std::string_view str, std::string& out);
 
 template<typename C, typename Func>
 std::string Stringify(const C& container, Func func, const std::string& start, const std::string& separator, const std::string& end) {
@@ -1,28 +1,98 @@
 #pragma once
 
+#include <array>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
 #include <optional>
+#include <set>
 #include <sstream>
 #include <string>
+#include <tuple>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "argument.h"
 #include "json.h"
+#include "flat.h"
 #include "sfinae.h"
 #include "stringify.h"
 
 namespace gcheck {
+
+/*
+    Whether copies of T are independent of the original, e.g. numbers, strings and standard containers of them.
+    These are rendered only when needed. Anything else, e.g. pointers and user classes that may refer to other
+    data, is rendered right away so that the description reflects the state at the time of construction.
+*/
+template<typename T>
+struct is_value_type : std::bool_constant<std::is_arithmetic_v<T> || std::is_enum_v<T>> {};
+template<typename T>
+constexpr bool is_value_type_v = is_value_type<T>::value;
+
+template<typename... Ts>
+struct is_value_type<std::basic_string<Ts...>> : std::true_type {};
+template<typename T, typename... Ts>
+struct is_value_type<std::vector<T, Ts...>> : is_value_type<T> {};
+template<typename T, typename... Ts>
+struct is_value_type<std::deque<T, Ts...>> : is_value_type<T> {};
+template<typename T, typename... Ts>
+struct is_value_type<std::list<T, Ts...>> : is_value_type<T> {};
+template<typename T, typename... Ts>
+struct is_value_type<std::set<T, Ts...>> : is_value_type<T> {};
+template<typename T, typename... Ts>
+struct is_value_type<std::multiset<T, Ts...>> : is_value_type<T> {};
+template<typename T, typename... Ts>
+struct is_value_type<std::unordered_set<T, Ts...>> : is_value_type<T> {};
+template<typename K, typename T, typename... Ts>
+struct is_value_type<std::map<K, T, Ts...>> : std::bool_constant<is_value_type_v<K> && is_value_type_v<T>> {};
+template<typename K, typename T, typename... Ts>
+struct is_value_type<std::unordered_map<K, T, Ts...>> : std::bool_constant<is_value_type_v<K> && is_value_type_v<T>> {};
+template<typename T, size_t N>
+struct is_value_type<std::array<T, N>> : is_value_type<T> {};
+template<typename T>
+struct is_value_type<std::optional<T>> : is_value_type<T> {};
+template<typename T, typename S>
+struct is_value_type<std::pair<T, S>> : std::bool_constant<is_value_type_v<T> && is_value_type_v<S>> {};
+template<typename... Ts>
+struct is_value_type<std::tuple<Ts...>> : std::bool_constant<(is_value_type_v<Ts> && ...)> {};
+
 /*
     Wrapper class for anything passed by users from tests.
     Includes a descriptor string constructed using operator std::string, to_string, std::to_string or "",
         in that order by first available method.
+    Value types (see is_value_type) are copied and described only when the description is first asked for,
+        so that objects of passing cases that aren't reported cost no more than a copy.
  */
 template<template<typename> class allocator = std::allocator>
 class _UserObject {
 	typedef std::basic_string<char, std::char_traits<char>, allocator<char>> stdstring;
 
+	// Describes a copy of the item on demand
+	struct Renderer {
+		virtual ~Renderer() {}
+		virtual std::string String() const = 0;
+		virtual JSON Json() const = 0;
+#ifdef GCHECK_CONSTRUCT_DATA
+		virtual std::string Construct() const = 0;
+#endif
+	};
+	template<typename T>
+	struct ItemRenderer : Renderer {
+		T item;
+
+		ItemRenderer(const T& item) : item(item) {}
+		std::string String() const override { return toString(item); }
+		JSON Json() const override { return JSON(item); }
+#ifdef GCHECK_CONSTRUCT_DATA
+		std::string Construct() const override { return toConstruct(item); }
+#endif
+	};
+
 public:
 	_UserObject() {}
 	_UserObject(const _UserObject &v) = default;
@@ -41,23 +111,30 @@ public:
 	_UserObject(const std::optional<_UserObject<T>> &item) = delete;
 	template<typename T>
 	_UserObject(const T &item) {
-		as_json_ = item;
-		as_string_ = toString(item);
+		if constexpr(is_value_type_v<T>) {
+			renderer_ = std::make_shared<const ItemRenderer<T>>(item);
+		} else {
+			as_json_ = item;
+			as_string_ = toString(item);
 #ifdef GCHECK_CONSTRUCT_DATA
-		construct_ = toConstruct(item);
+			construct_ = toConstruct(item);
 #endif
+		}
 	}
 	template<typename... Args>
 	_UserObject(const Args &...items) : _UserObject(std::tuple<Args...>(items...)) {}
 
 	JSON json() const {
+		Render();
 		return as_json_;
 	}
 	std::string string() const {
+		Render();
 		return (std::string) as_string_;
 	}
 #ifdef GCHECK_CONSTRUCT_DATA
 	std::string construct() const {
+		Render();
 		return (std::string) construct_;
 	}
 #endif
@@ -67,11 +144,25 @@ public:
 		return *this = _UserObject(v);
 	}
 
+	friend void Flatten(FlatWriter& w, const _UserObject<std::allocator>& o);
+	friend void Unflatten(FlatReader& r, _UserObject<std::allocator>& o);
 private:
-	stdstring as_string_;
-	_JSON<allocator> as_json_;
+	void Render() const {
+		if(!renderer_)
+			return;
+		as_string_ = renderer_->String();
+		as_json_ = renderer_->Json();
+#ifdef GCHECK_CONSTRUCT_DATA
+		construct_ = renderer_->Construct();
+#endif
+		renderer_.reset();
+	}
+
+	mutable std::shared_ptr<const Renderer> renderer_; // Set until a value type is rendered
+	mutable stdstring as_string_;
+	mutable _JSON<allocator> as_json_;
 #ifdef GCHECK_CONSTRUCT_DATA
-	stdstring construct_; // a string representation on how to construct the object e.g. "std::vector<int>({0, 1, 2})"
+	mutable stdstring construct_; // a string representation on how to construct the object e.g. "std::vector<int>({0, 1, 2})"
 #endif
 };
 
@@ -0,0 +1,263 @@
+#include "allocation_tracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <new>
+
+#if defined(__GLIBC__)
+    #define GCHECK_INTERPOSE_MALLOC
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t n, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void* ptr);
+}
+#endif
+
+namespace gcheck {
+
+namespace {
+    // The allocator the tracked functions forward to
+#if defined(GCHECK_INTERPOSE_MALLOC)
+    void* real_malloc(size_t size) { return __libc_malloc(size); }
+    void* real_calloc(size_t n, size_t size) { return __libc_calloc(n, size); }
+    void* real_realloc(void* ptr, size_t size) { return __libc_realloc(ptr, size); }
+    void* real_memalign(size_t alignment, size_t size) { return __libc_memalign(alignment, size); }
+    void real_free(void* ptr) { __libc_free(ptr); }
+#else
+    void* real_malloc(size_t size) { return std::malloc(size); }
+    void* real_calloc(size_t n, size_t size) { return std::calloc(n, size); }
+    void* real_realloc(void* ptr, size_t size) { return std::realloc(ptr, size); }
+    void* real_memalign(size_t alignment, size_t size) {
+        return std::aligned_alloc(alignment, (size + alignment - 1)/alignment*alignment);
+    }
+    void real_free(void* ptr) { std::free(ptr); }
+#endif
+
+    enum State : int { Off, Recording, Paused };
+
+    // Everything here is constant initialized, so allocations before static initialization are fine
+    std::atomic<int> state{Off};
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+
+    /*
+        Open addressing table of the live recorded blocks. Its memory comes from the real allocator, so
+        using it doesn't recurse into the tracking.
+    */
+    struct Slot {
+        void* ptr;
+        size_t size;
+    };
+    void* const tombstone = (void*)1;
+    Slot* table = nullptr;
+    size_t capacity = 0; // Power of two
+    size_t used = 0; // Live slots and tombstones
+    size_t live_blocks = 0;
+    size_t live_bytes = 0;
+    AllocationStats stats;
+
+    class Guard {
+    public:
+        Guard() { while(lock.test_and_set(std::memory_order_acquire)) {} }
+        ~Guard() { lock.clear(std::memory_order_release); }
+    };
+
+    size_t slot_of(void* ptr) {
+        return (size_t)(((uintptr_t)ptr >> 4)*0x9E3779B97F4A7C15ull) & (capacity - 1);
+    }
+
+    void insert_slot(void* ptr, size_t size) {
+        size_t i = slot_of(ptr);
+        while(table[i].ptr && table[i].ptr != tombstone)
+            i = (i + 1) & (capacity - 1);
+        if(!table[i].ptr)
+            used++;
+        table[i] = {ptr, size};
+    }
+
+    bool grow() {
+        size_t new_capacity = capacity ? capacity*2 : 1024;
+        Slot* new_table = (Slot*)real_calloc(new_capacity, sizeof(Slot));
+        if(!new_table)
+            return false;
+
+        Slot* old_table = table;
+        size_t old_capacity = capacity;
+        table = new_table;
+        capacity = new_capacity;
+        used = 0;
+        for(size_t i = 0; i < old_capacity; i++)
+            if(old_table[i].ptr && old_table[i].ptr != tombstone)
+                insert_slot(old_table[i].ptr, old_table[i].size);
+        real_free(old_table);
+        return true;
+    }
+
+    void record(void* ptr, size_t size) {
+        if(!ptr || state.load(std::memory_order_relaxed) != Recording)
+            return;
+
+        Guard guard;
+        if(state.load(std::memory_order_relaxed) != Recording)
+            return;
+
+        stats.allocations++;
+        stats.bytes += size;
+        // Keep the table at most half full. A block that doesn't fit is counted but not tracked.
+        if((used + 1)*2 > capacity && !grow())
+            return;
+        insert_slot(ptr, size);
+        live_blocks++;
+        live_bytes += size;
+        if(live_bytes > stats.peak_bytes)
+            stats.peak_bytes = live_bytes;
+    }
+
+    void forget(void* ptr) {
+        if(!ptr || state.load(std::memory_order_relaxed) == Off)
+            return;
+
+        Guard guard;
+        if(state.load(std::memory_order_relaxed) == Off || !capacity)
+            return;
+
+        for(size_t i = slot_of(ptr); table[i].ptr; i = (i + 1) & (capacity - 1)) {
+            if(table[i].ptr == ptr) {
+                live_blocks--;
+                live_bytes -= table[i].size;
+                table[i].ptr = tombstone;
+                return;
+            }
+        }
+    }
+
+    void* tracked_malloc(size_t size) {
+        void* ptr = real_malloc(size);
+        record(ptr, size);
+        return ptr;
+    }
+    void* tracked_calloc(size_t n, size_t size) {
+        void* ptr = real_calloc(n, size);
+        record(ptr, n*size);
+        return ptr;
+    }
+    void* tracked_realloc(void* ptr, size_t size) {
+        void* new_ptr = real_realloc(ptr, size);
+        if(new_ptr || size == 0) {
+            forget(ptr);
+            record(new_ptr, size);
+        }
+        return new_ptr;
+    }
+    void* tracked_memalign(size_t alignment, size_t size) {
+        void* ptr = real_memalign(alignment, size);
+        record(ptr, size);
+        return ptr;
+    }
+    void tracked_free(void* ptr) {
+        forget(ptr);
+        real_free(ptr);
+    }
+
+    void* new_impl(size_t size, size_t alignment = 0) {
+        if(size == 0)
+            size = 1;
+        while(true) {
+            void* ptr = alignment ? tracked_memalign(alignment, size) : tracked_malloc(size);
+            if(ptr)
+                return ptr;
+            std::new_handler handler = std::get_new_handler();
+            if(!handler)
+                throw std::bad_alloc();
+            handler();
+        }
+    }
+    void* new_nothrow_impl(size_t size, size_t alignment = 0) noexcept {
+        try {
+            return new_impl(size, alignment);
+        } catch(...) {
+            return nullptr;
+        }
+    }
+} // anonymous
+
+void AllocationTracker::Start() {
+    Guard guard;
+    stats = AllocationStats();
+    live_blocks = 0;
+    live_bytes = 0;
+    used = 0;
+    if(table)
+        std::memset((void*)table, 0, capacity*sizeof(Slot));
+    state.store(Recording, std::memory_order_relaxed);
+}
+
+void AllocationTracker::Pause() {
+    Guard guard;
+    if(state.load(std::memory_order_relaxed) == Recording)
+        state.store(Paused, std::memory_order_relaxed);
+}
+
+AllocationStats AllocationTracker::Stop() {
+    Guard guard;
+    state.store(Off, std::memory_order_relaxed);
+
+    AllocationStats result = stats;
+    result.leaked_blocks = live_blocks;
+    result.leaked_bytes = live_bytes;
+
+    real_free(table);
+    table = nullptr;
+    capacity = 0;
+    used = 0;
+    return result;
+}
+
+} // gcheck
+
+#if defined(GCHECK_INTERPOSE_MALLOC)
+// glibc calls these through the PLT too, so C code and libraries of the tested function are seen as well
+extern "C" {
+    void* malloc(size_t size) noexcept { return gcheck::tracked_malloc(size); }
+    void* calloc(size_t n, size_t size) noexcept { return gcheck::tracked_calloc(n, size); }
+    void* realloc(void* ptr, size_t size) noexcept { return gcheck::tracked_realloc(ptr, size); }
+    void free(void* ptr) noexcept { gcheck::tracked_free(ptr); }
+    void* memalign(size_t alignment, size_t size) noexcept { return gcheck::tracked_memalign(alignment, size); }
+    void* aligned_alloc(size_t alignment, size_t size) noexcept { return gcheck::tracked_memalign(alignment, size); }
+    int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept {
+        if(alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+            return EINVAL;
+        void* p = gcheck::tracked_memalign(alignment, size);
+        if(!p)
+            return ENOMEM;
+        *ptr = p;
+        return 0;
+    }
+}
+#endif
+
+void* operator new(size_t size) { return gcheck::new_impl(size); }
+void* operator new[](size_t size) { return gcheck::new_impl(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return gcheck::new_nothrow_impl(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return gcheck::new_nothrow_impl(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return gcheck::new_impl(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return gcheck::new_impl(size, (size_t)alignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return gcheck::new_nothrow_impl(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return gcheck::new_nothrow_impl(size, (size_t)alignment); }
+
+void operator delete(void* ptr) noexcept { gcheck::tracked_free(ptr); }
+void operator delete[](void* ptr) noexcept { gcheck::tracked_free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { gcheck::tracked_free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { gcheck::tracked_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { gcheck::tracked_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { gcheck::tracked_free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { gcheck::tracked_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { gcheck::tracked_free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { gcheck::tracked_free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { gcheck::tracked_free(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { gcheck::tracked_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { gcheck::tracked_free(ptr); }
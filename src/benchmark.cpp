@@ -0,0 +1,74 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gcheck {
+
+namespace {
+    // Sample at quantile q of sorted samples by the nearest rank method
+    std::chrono::nanoseconds quantile(const std::vector<std::chrono::nanoseconds>& sorted, double q) {
+        size_t rank = (size_t)std::ceil(q*sorted.size());
+        return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+    }
+
+    std::chrono::nanoseconds median(std::vector<std::chrono::nanoseconds> samples) {
+        std::sort(samples.begin(), samples.end());
+        size_t n = samples.size();
+        return n % 2 ? samples[n/2] : (samples[n/2-1] + samples[n/2])/2;
+    }
+
+    std::chrono::nanoseconds mad(const std::vector<std::chrono::nanoseconds>& samples, std::chrono::nanoseconds med) {
+        std::vector<std::chrono::nanoseconds> deviations;
+        deviations.reserve(samples.size());
+        for(auto& s : samples)
+            deviations.push_back(s > med ? s - med : med - s);
+        return median(std::move(deviations));
+    }
+} // anonymous
+
+RunTimeStats::RunTimeStats(std::vector<std::chrono::nanoseconds> samples, RunTimeStatistic statistic)
+        : samples(samples.size()), statistic(statistic) {
+    if(samples.empty())
+        return;
+
+    std::sort(samples.begin(), samples.end());
+    minimum = samples.front();
+    maximum = samples.back();
+
+    std::chrono::nanoseconds sum = std::chrono::nanoseconds::zero();
+    for(auto& s : samples)
+        sum += s;
+    mean = sum/samples.size();
+
+    median = gcheck::median(samples);
+    percentile90 = quantile(samples, 0.9);
+    percentile99 = quantile(samples, 0.99);
+    mad = gcheck::mad(samples, median);
+}
+
+std::chrono::nanoseconds RunTimeStats::Value() const {
+    switch(statistic) {
+    case Minimum:
+        return minimum;
+    case Mean:
+        return mean;
+    case Percentile90:
+        return percentile90;
+    case Median:
+    default:
+        return median;
+    }
+}
+
+bool RunTimeStats::IsPrecise(const std::vector<std::chrono::nanoseconds>& samples, double relative_error) {
+    if(samples.size() < 2)
+        return false;
+
+    auto med = gcheck::median(samples);
+    // 1.4826*MAD estimates the standard deviation and the standard error of the median is about 1.2533*sd/sqrt(n)
+    double error = 1.96*1.2533*1.4826*gcheck::mad(samples, med).count()/std::sqrt((double)samples.size());
+    return error <= relative_error*med.count();
+}
+
+} // gcheck
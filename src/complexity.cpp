@@ -0,0 +1,102 @@
+#include "complexity.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace gcheck {
+
+namespace {
+    double scale(Complexity c, double n) {
+        switch(c) {
+        case OLogN:
+            return std::log2(n);
+        case ON:
+            return n;
+        case ONLogN:
+            return n*std::log2(n);
+        case ON2:
+            return n*n;
+        case ON3:
+            return n*n*n;
+        case O1:
+        default:
+            return 1;
+        }
+    }
+} // anonymous
+
+std::string ComplexityName(Complexity c) {
+    switch(c) {
+    case OLogN:
+        return "O(log n)";
+    case ON:
+        return "O(n)";
+    case ONLogN:
+        return "O(n log n)";
+    case ON2:
+        return "O(n^2)";
+    case ON3:
+        return "O(n^3)";
+    case O1:
+    default:
+        return "O(1)";
+    }
+}
+
+ComplexityFit FitComplexity(const std::vector<size_t>& sizes, const std::vector<std::chrono::nanoseconds>& run_times, Complexity complexity) {
+    if(sizes.size() != run_times.size())
+        throw std::invalid_argument("FitComplexity: sizes and run_times differ in length");
+
+    ComplexityFit fit;
+    fit.complexity = complexity;
+    if(sizes.empty())
+        return fit;
+
+    // Least squares of the relative residuals (t - a*f(n))/t. Relative, so that the largest sizes don't decide
+    // the fit alone, and without a constant term, so that the constant overhead doesn't hide the growth.
+    double ft = 0, ff = 0;
+    for(size_t i = 0; i < sizes.size(); i++) {
+        double t = std::max((double)run_times[i].count(), 1.0);
+        double f = scale(complexity, (double)sizes[i])/t;
+        ft += f;
+        ff += f*f;
+    }
+    fit.coefficient = ff > 0 ? ft/ff : 0;
+
+    double squares = 0;
+    for(size_t i = 0; i < sizes.size(); i++) {
+        double t = std::max((double)run_times[i].count(), 1.0);
+        double residual = (t - fit.coefficient*scale(complexity, (double)sizes[i]))/t;
+        squares += residual*residual;
+    }
+    fit.error = std::sqrt(squares/sizes.size());
+
+    return fit;
+}
+
+std::vector<ComplexityFit> FitComplexities(const std::vector<size_t>& sizes, const std::vector<std::chrono::nanoseconds>& run_times) {
+    std::vector<ComplexityFit> fits;
+    for(Complexity c : {O1, OLogN, ON, ONLogN, ON2, ON3})
+        fits.push_back(FitComplexity(sizes, run_times, c));
+
+    // Stable so that the lower class wins a tie
+    std::stable_sort(fits.begin(), fits.end(), [](const ComplexityFit& a, const ComplexityFit& b) { return a.error < b.error; });
+    return fits;
+}
+
+std::vector<size_t> SizeLadder(size_t first, size_t last, size_t count) {
+    if(count == 0)
+        return {};
+    if(count == 1 || first == 0 || last <= first)
+        return std::vector<size_t>(count, first);
+
+    std::vector<size_t> sizes;
+    double factor = std::pow((double)last/first, 1.0/(count-1));
+    for(size_t i = 0; i < count; i++)
+        sizes.push_back((size_t)std::llround(first*std::pow(factor, (double)i)));
+    sizes.back() = last;
+    return sizes;
+}
+
+} // gcheck
@@ -1,12 +1,18 @@
 #include "console_writer.h"
 
 #include <unistd.h>
+#include <cerrno>
 #include <iostream>
 #include <algorithm>
 
 namespace gcheck {
 
 int ConsoleWriter::width_ = -1;
+size_t ConsoleWriter::max_cell_length_ = 16*1024;
+
+ConsoleWriter::~ConsoleWriter() {
+    Flush();
+}
 
 int ConsoleWriter::GetWidth() {
     if(width_ != -1)
@@ -37,13 +43,13 @@ int ConsoleWriter::GetWidth() {
     return w < 5 ? w = 128 : w;
 }
 
-std::vector<int> ConsoleWriter::CalcWidths(const std::vector<std::string>& strs, std::vector<int> widths) {
+std::vector<int> ConsoleWriter::CalcWidths(const std::vector<std::string_view>& strs, std::vector<int> widths) {
     if(widths.size() < strs.size())
         widths.resize(strs.size(), 0);
 
     auto it2 = widths.begin();
     for(auto it = strs.begin(); it != strs.end(); it++, it2++) {
-        const std::string& str = *it;
+        std::string_view str = *it;
         int& max_width = *it2;
         for(size_t pos = 0, pos2 = 0; pos2 != std::string::npos; pos = pos2+1) {
             pos2 = str.find('\n', pos);
@@ -56,7 +62,28 @@ std::vector<int> ConsoleWriter::CalcWidths(const std::vector<std::string>& strs,
     return widths;
 }
 
-void ConsoleWriter::WriteRow(int width, const std::vector<std::string>& cells, const std::vector<int>& widths, const std::vector<int>& cuts) {
+std::string_view ConsoleWriter::Elide(const std::string& cell) {
+    if(max_cell_length_ == 0 || cell.length() <= max_cell_length_)
+        return cell;
+
+    // Don't cut UTF-8 sequences
+    auto is_continuation = [&cell](size_t pos) { return ((unsigned char)cell[pos] & 0xC0) == 0x80; };
+    size_t head = max_cell_length_/2;
+    while(head > 0 && is_continuation(head))
+        head--;
+    size_t tail = cell.length() - (max_cell_length_ - max_cell_length_/2);
+    while(tail < cell.length() && is_continuation(tail))
+        tail++;
+
+    std::string& elided = elided_.emplace_back();
+    elided.reserve(max_cell_length_ + 64);
+    elided.append(cell, 0, head);
+    elided += "\n[... " + std::to_string(tail - head) + " bytes elided ...]\n";
+    elided.append(cell, tail);
+    return elided;
+}
+
+void ConsoleWriter::WriteRow(int width, const std::vector<std::string_view>& cells, const std::vector<int>& widths, const std::vector<int>& cuts) {
 
     if(width < 5) {
         width = 128;
@@ -68,13 +95,14 @@ void ConsoleWriter::WriteRow(int width, const std::vector<std::string>& cells, c
     if(totalwidth > width)
         totalwidth = width;
 
-    std::vector<std::vector<std::string>> parts;
+    // The lines of the cells, a row of the table can span several lines
+    std::vector<std::vector<std::string_view>> parts;
 
     std::vector<size_t> poss(cells.size(), 0);
     unsigned int num_done = 0;
     while(num_done != poss.size()) {
         parts.push_back({});
-        std::vector<std::string>& row = parts[parts.size()-1];
+        std::vector<std::string_view>& row = parts[parts.size()-1];
         for(unsigned int i = 0; i < poss.size(); i++) {
             if(poss[i] != std::string::npos) {
                 size_t end = cells[i].find('\n', poss[i]);
@@ -95,98 +123,144 @@ void ConsoleWriter::WriteRow(int width, const std::vector<std::string>& cells, c
     int pos = 0;
     for(auto it = cuts.begin(); it != cuts.end(); it++) {
         if(pos == 0)
-            std::cout << "+";
-        else std::cout << "  ";
+            buffer_ += '+';
+        else buffer_ += "  ";
         int t_width = (pos == 0 ? 1 : 2);
         for(int i = 0; i < *it; ++i) {
             int w = std::min(widths[pos+i], totalwidth - (pos == 0 ? 2 : 3));
             t_width += w + 1;
-            std::cout << std::string(w, '-') << '+';
+            buffer_.append(w, '-');
+            buffer_ += '+';
         }
         if(terminating_newline_ || t_width != width)
-            std::cout << std::endl;
+            buffer_ += '\n';
         for(auto& row : parts) {
 
-            std::string pad = "|";
+            std::string_view pad = "|";
             if(pos != 0)
                 pad = "  ";
-            std::cout << pad;
+            buffer_ += pad;
 
             if(row[pos].length() > totalwidth-pad.length()-1) {
                 size_t len = totalwidth-pad.length()-1;
-                SetColor(BrightBlack);
-                std::cout << row[pos].substr(0, len);
+                AppendColor(BrightBlack);
+                buffer_ += row[pos].substr(0, len);
 
                 size_t p = len;
                 len = totalwidth-pad.length()-2;
                 for(; p < row[pos].length(); p += len) {
-                    SetColor(Black);
-                    std::cout << '|' << pad << "  ";
-                    SetColor(BrightBlack);
-                    std::cout << row[pos].substr(p, len);
+                    AppendColor(Black);
+                    buffer_ += '|';
+                    buffer_ += pad;
+                    buffer_ += "  ";
+                    AppendColor(BrightBlack);
+                    buffer_ += row[pos].substr(p, len);
                 }
-                SetColor(Black);
-                std::cout << std::string(std::max(p-row[pos].length(), (size_t)1)-1, ' ') << '|';
+                AppendColor(Black);
+                buffer_.append(std::max(p-row[pos].length(), (size_t)1)-1, ' ');
+                buffer_ += '|';
             } else {
                 t_width = (pos == 0 ? 1 : 2);
                 for(int i = 0; i < *it; ++i) {
-                    SetColor(BrightBlack);
-                    std::cout << row[pos+i];
-                    SetColor(Black);
-                    int w = std::min(widths[pos+i], totalwidth - (pos == 0 ? 2 : 3));;
+                    AppendColor(BrightBlack);
+                    buffer_ += row[pos+i];
+                    AppendColor(Black);
+                    int w = std::min(widths[pos+i], totalwidth - (pos == 0 ? 2 : 3));
                     t_width += w + 1;
-                    std::cout << std::string(w-row[pos+i].length(), ' ') << '|';
+                    buffer_.append(w-row[pos+i].length(), ' ');
+                    buffer_ += '|';
                 }
                 if(terminating_newline_ || t_width != width)
-                    std::cout << std::endl;
+                    buffer_ += '\n';
             }
         }
         if(cuts.size() > 1 && it == cuts.end()-1)
-            std::cout << std::endl;
+            buffer_ += '\n';
         pos += *it;
     }
 }
 
-void ConsoleWriter::SetColor(Color color) {
-    if(use_colors_) {
-        std::cout.flush();
+void ConsoleWriter::AppendColor(Color color) {
+    if(!use_colors_ || color_ == color)
+        return;
+    color_ = color;
 #if defined(_WIN32) || defined(WIN32)
-        if(color == Original)
-            color = Black;
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        SetConsoleTextAttribute(hConsole, (WORD)color);
+    // The console attributes apply to what has been written so far
+    Flush();
+    if(color == Original)
+        color = Black;
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    SetConsoleTextAttribute(hConsole, (WORD)color);
 #else //lets hope it is unix
-        if(color == Original)
-            std::cout << "\033[0m";
-        else
-            std::cout << "\033[48;5;" + std::to_string((int)color) + "m";
+    if(color == Original)
+        buffer_ += "\033[0m";
+    else
+        buffer_ += "\033[48;5;" + std::to_string((int)color) + "m";
 #endif
+}
+
+void ConsoleWriter::SetColor(Color color) {
+    AppendColor(color);
+    // What follows is written through std::cout
+    Flush();
+}
+
+void ConsoleWriter::Flush() {
+    if(buffer_.empty())
+        return;
+
+    std::cout.flush();
+#if defined(_WIN32) || defined(WIN32)
+    std::cout.write(buffer_.data(), buffer_.size());
+    std::cout.flush();
+#else
+    const char* data = buffer_.data();
+    size_t left = buffer_.size();
+    while(left > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, left);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        data += written;
+        left -= written;
     }
+#endif
+    buffer_.clear();
 }
 
 void ConsoleWriter::WriteSeparator() {
     int width = GetWidth();
-    std::cout << std::string(width, '*');
+    buffer_.append(width, '*');
     if(terminating_newline_)
-        std::cout << std::endl;
+        buffer_ += '\n';
+    Flush();
 }
 
 void ConsoleWriter::SetHeaders(const std::vector<std::string>& headers) {
     headers_ = headers;
-    header_widths_ = CalcWidths(headers);
+    header_widths_ = CalcWidths(std::vector<std::string_view>(headers.begin(), headers.end()));
 }
 
 void ConsoleWriter::WriteRow(const std::vector<std::string>& cells) {
     WriteRows(std::vector<std::vector<std::string>>(1, cells));
 }
 
-void ConsoleWriter::WriteRows(std::vector<std::vector<std::string>> cells) {
+void ConsoleWriter::WriteRows(const std::vector<std::vector<std::string>>& cells) {
 
     int width = GetWidth();
     std::vector<int> widths = header_widths_;
-    for(auto& r : cells)
-        widths = CalcWidths(r, widths);
-    for(auto& r : cells)
+    std::vector<std::vector<std::string_view>> rows;
+    rows.reserve(cells.size());
+    for(auto& r : cells) {
+        auto& row = rows.emplace_back();
+        row.reserve(r.size());
+        for(auto& cell : r)
+            row.push_back(Elide(cell));
+        widths = CalcWidths(row, widths);
+    }
+    for(auto& r : rows)
         if(r.size() < widths.size())
             r.resize(widths.size(), "");
 
@@ -204,21 +278,20 @@ void ConsoleWriter::WriteRows(std::vector<std::vector<std::string>> cells) {
     cuts.push_back(counter);
 
     if(headers_.size() != 0) {
-        if(headers_.size() != widths.size()) {
-            auto headers = headers_;
-            headers.resize(widths.size(), "");
-            WriteRow(width, headers, widths, cuts);
-        } else {
-            WriteRow(width, headers_, widths, cuts);
-        }
+        std::vector<std::string_view> headers(headers_.begin(), headers_.end());
+        headers.resize(widths.size(), "");
+        WriteRow(width, headers, widths, cuts);
     }
-    for(auto& r : cells) {
+    for(auto& r : rows) {
         WriteRow(width, r, widths, cuts);
     }
     for(int i = 0; i < cuts[0]; i++) {
-        std::cout << '+' << std::string(widths[i], '-');
+        buffer_ += '+';
+        buffer_.append(widths[i], '-');
     }
-    std::cout << '+' << std::endl;
+    buffer_ += "+\n";
+    Flush();
+    elided_.clear();
 }
 
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <deque>
 
 #if defined(_WIN32) || defined(WIN32)
     #ifndef NOMINMAX
@@ -16,6 +18,8 @@ namespace gcheck {
 class ConsoleWriter {
 public:
     static int width_;
+    // Longer cells are shown as their start and end around an elision mark. 0 for no limit.
+    static size_t max_cell_length_;
 
 #if defined(_WIN32) || defined(WIN32)
     enum Color : int {
@@ -41,16 +45,28 @@ private:
     std::vector<std::string> headers_;
     std::vector<int> header_widths_;
 
+    // The output is laid out here and written at once by Flush
+    std::string buffer_;
+    // Storage of the elided cells the rows being written point to
+    std::deque<std::string> elided_;
+    int color_ = -1; // Last color written, -1 if none yet
+
     bool terminating_newline_ = false;
     bool use_colors_ = false; // TODO: determine if terminal supports colors
 
     int GetWidth();
 
-    std::vector<int> CalcWidths(const std::vector<std::string>& strs, std::vector<int> widths = std::vector<int>());
+    std::vector<int> CalcWidths(const std::vector<std::string_view>& strs, std::vector<int> widths = std::vector<int>());
+
+    std::string_view Elide(const std::string& cell);
 
-    void WriteRow(int width, const std::vector<std::string>& cells, const std::vector<int>& widths, const std::vector<int>& cuts);
+    void AppendColor(Color color);
+
+    void WriteRow(int width, const std::vector<std::string_view>& cells, const std::vector<int>& widths, const std::vector<int>& cuts);
 public:
+    ~ConsoleWriter();
 
+    // Sets the color of the output that follows. Does nothing if it's the current color.
     void SetColor(Color color);
 
     void WriteSeparator();
@@ -59,7 +75,10 @@ public:
 
     void WriteRow(const std::vector<std::string>& cells);
 
-    void WriteRows(std::vector<std::vector<std::string>> cells);
+    void WriteRows(const std::vector<std::vector<std::string>>& cells);
+
+    // Writes the buffered output to stdout with a single write, after whatever std::cout has buffered
+    void Flush();
 };
 
 }
\ No newline at end of file
@@ -7,11 +7,18 @@ namespace gcheck {
 
 void CustomTest::ActualTest() {
     if(do_safe_run_) {
-        auto status = RunForked(std::chrono::duration<double>(timeout_), data_, 1024*1024, std::bind(&CustomTest::TheTest, this));
+        ResourceUsage usage;
+        auto status = RunForkedLimited(std::chrono::duration<double>(timeout_), limits_, usage, data_, [this]() {
+            forked_ = true;
+            TheTest();
+        });
+        data_.resource_usage = usage;
         if(status == OK) {
             data_.status = Finished;
         } else if(status == TIMEDOUT) {
-            data_.status = TimedOut;
+            ReportUnfinished(data_, TimedOut, "Timed out");
+        } else {
+            ReportUnfinished(data_, Crashed, "Crashed");
         }
     } else {
         TheTest();
@@ -19,6 +26,40 @@ void CustomTest::ActualTest() {
     }
 }
 
+void CustomTest::SetLimits(const ResourceLimits& limits) {
+    if(limits.cpu_time) limits_.cpu_time = limits.cpu_time;
+    if(limits.memory) limits_.memory = limits.memory;
+    if(limits.file_size) limits_.file_size = limits.file_size;
+    if(limits.processes) limits_.processes = limits.processes;
+
+    if(forked_)
+        limits.Apply();
+}
+
+void CustomTest::SetMaxCPUTime(double seconds) {
+    ResourceLimits limits;
+    limits.cpu_time = seconds;
+    SetLimits(limits);
+}
+
+void CustomTest::SetMaxMemory(size_t bytes) {
+    ResourceLimits limits;
+    limits.memory = bytes;
+    SetLimits(limits);
+}
+
+void CustomTest::SetMaxFileSize(size_t bytes) {
+    ResourceLimits limits;
+    limits.file_size = bytes;
+    SetLimits(limits);
+}
+
+void CustomTest::SetMaxProcesses(size_t n) {
+    ResourceLimits limits;
+    limits.processes = n;
+    SetLimits(limits);
+}
+
 std::stringstream& CustomTest::ExpectTrue(bool b, std::string descriptor) {
 
     TestReport report = TestReport::Make<TrueData>();
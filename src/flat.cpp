@@ -0,0 +1,381 @@
+#include "flat.h"
+
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include "gcheck.h"
+#include "user_object.h"
+
+namespace gcheck {
+
+FlatWriter::FlatWriter(void* memory, size_t size) : memory_((char*)memory), size_(size), used_(sizeof(size_t)) {
+    if(size_ < used_)
+        throw std::bad_alloc();
+    size_t data_size = 0;
+    std::memcpy(memory_, &data_size, sizeof(data_size));
+}
+
+void FlatWriter::Write(const void* data, size_t n) {
+    if(n > size_ - used_)
+        throw std::bad_alloc();
+
+    std::memcpy(memory_ + used_, data, n);
+    used_ += n;
+
+    size_t data_size = used_ - sizeof(size_t);
+    std::memcpy(memory_, &data_size, sizeof(data_size));
+}
+
+FlatReader::FlatReader(const void* memory, size_t size) : memory_((const char*)memory), position_(sizeof(size_t)) {
+    size_t data_size;
+    if(size < position_)
+        throw std::runtime_error("Flat data is missing its size");
+    std::memcpy(&data_size, memory_, sizeof(data_size));
+    if(data_size > size - position_)
+        throw std::runtime_error("Flat data is larger than its memory");
+    end_ = position_ + data_size;
+}
+
+void FlatReader::Read(void* data, size_t n) {
+    std::memcpy(data, View(n).data(), n);
+}
+
+std::string_view FlatReader::View(size_t n) {
+    if(n > end_ - position_)
+        throw std::runtime_error("Flat data ended prematurely");
+
+    std::string_view view(memory_ + position_, n);
+    position_ += n;
+    return view;
+}
+
+void Flatten(FlatWriter& w, const std::string& str) {
+    Flatten(w, str.size());
+    w.Write(str.data(), str.size());
+}
+void Unflatten(FlatReader& r, std::string& str) {
+    size_t size;
+    Unflatten(r, size);
+    str = r.View(size);
+}
+
+void Flatten(FlatWriter& w, const ResourceUsage& u) {
+    Flatten(w, u.user_time);
+    Flatten(w, u.system_time);
+    Flatten(w, u.max_rss);
+    Flatten(w, u.minor_faults);
+    Flatten(w, u.major_faults);
+    Flatten(w, u.voluntary_switches);
+    Flatten(w, u.involuntary_switches);
+}
+void Unflatten(FlatReader& r, ResourceUsage& u) {
+    Unflatten(r, u.user_time);
+    Unflatten(r, u.system_time);
+    Unflatten(r, u.max_rss);
+    Unflatten(r, u.minor_faults);
+    Unflatten(r, u.major_faults);
+    Unflatten(r, u.voluntary_switches);
+    Unflatten(r, u.involuntary_switches);
+}
+
+void Flatten(FlatWriter& w, const RunTimeStats& s) {
+    Flatten(w, s.samples);
+    Flatten(w, s.minimum);
+    Flatten(w, s.maximum);
+    Flatten(w, s.mean);
+    Flatten(w, s.median);
+    Flatten(w, s.percentile90);
+    Flatten(w, s.percentile99);
+    Flatten(w, s.mad);
+    Flatten(w, s.statistic);
+}
+void Unflatten(FlatReader& r, RunTimeStats& s) {
+    Unflatten(r, s.samples);
+    Unflatten(r, s.minimum);
+    Unflatten(r, s.maximum);
+    Unflatten(r, s.mean);
+    Unflatten(r, s.median);
+    Unflatten(r, s.percentile90);
+    Unflatten(r, s.percentile99);
+    Unflatten(r, s.mad);
+    Unflatten(r, s.statistic);
+}
+
+void Flatten(FlatWriter& w, const PerfCounters& c) {
+    Flatten(w, c.instructions);
+    Flatten(w, c.cycles);
+    Flatten(w, c.cache_misses);
+    Flatten(w, c.branch_misses);
+    Flatten(w, c.task_clock);
+}
+void Unflatten(FlatReader& r, PerfCounters& c) {
+    Unflatten(r, c.instructions);
+    Unflatten(r, c.cycles);
+    Unflatten(r, c.cache_misses);
+    Unflatten(r, c.branch_misses);
+    Unflatten(r, c.task_clock);
+}
+
+void Flatten(FlatWriter& w, const AllocationStats& s) {
+    Flatten(w, s.allocations);
+    Flatten(w, s.bytes);
+    Flatten(w, s.peak_bytes);
+    Flatten(w, s.leaked_blocks);
+    Flatten(w, s.leaked_bytes);
+}
+void Unflatten(FlatReader& r, AllocationStats& s) {
+    Unflatten(r, s.allocations);
+    Unflatten(r, s.bytes);
+    Unflatten(r, s.peak_bytes);
+    Unflatten(r, s.leaked_blocks);
+    Unflatten(r, s.leaked_bytes);
+}
+
+void Flatten(FlatWriter& w, const OutputComparison& c) {
+    Flatten(w, c.size);
+    Flatten(w, c.mismatch);
+    Flatten(w, c.truncated);
+    Flatten(w, c.window);
+}
+void Unflatten(FlatReader& r, OutputComparison& c) {
+    Unflatten(r, c.size);
+    Unflatten(r, c.mismatch);
+    Unflatten(r, c.truncated);
+    Unflatten(r, c.window);
+}
+
+void Flatten(FlatWriter& w, const _UserObject<std::allocator>& o) {
+    o.Render();
+    Flatten(w, o.as_string_);
+    Flatten(w, o.as_json_);
+#ifdef GCHECK_CONSTRUCT_DATA
+    Flatten(w, o.construct_);
+#endif
+}
+void Unflatten(FlatReader& r, _UserObject<std::allocator>& o) {
+    o.renderer_.reset();
+    Unflatten(r, o.as_string_);
+    Unflatten(r, o.as_json_);
+#ifdef GCHECK_CONSTRUCT_DATA
+    Unflatten(r, o.construct_);
+#endif
+}
+
+void Flatten(FlatWriter& w, const _EqualsData<std::allocator>& d) {
+    Flatten(w, d.output_expected);
+    Flatten(w, d.output);
+    Flatten(w, d.descriptor);
+    Flatten(w, d.result);
+}
+void Unflatten(FlatReader& r, _EqualsData<std::allocator>& d) {
+    Unflatten(r, d.output_expected);
+    Unflatten(r, d.output);
+    Unflatten(r, d.descriptor);
+    Unflatten(r, d.result);
+}
+
+void Flatten(FlatWriter& w, const _TrueData<std::allocator>& d) {
+    Flatten(w, d.value);
+    Flatten(w, d.descriptor);
+    Flatten(w, d.result);
+}
+void Unflatten(FlatReader& r, _TrueData<std::allocator>& d) {
+    Unflatten(r, d.value);
+    Unflatten(r, d.descriptor);
+    Unflatten(r, d.result);
+}
+
+void Flatten(FlatWriter& w, const _FalseData<std::allocator>& d) {
+    Flatten(w, d.value);
+    Flatten(w, d.descriptor);
+    Flatten(w, d.result);
+}
+void Unflatten(FlatReader& r, _FalseData<std::allocator>& d) {
+    Unflatten(r, d.value);
+    Unflatten(r, d.descriptor);
+    Unflatten(r, d.result);
+}
+
+void Flatten(FlatWriter& w, const _CaseEntry<std::allocator>& e) {
+    Flatten(w, e.arguments);
+    Flatten(w, e.input);
+    Flatten(w, e.output);
+    Flatten(w, e.output_expected);
+    Flatten(w, e.result);
+}
+void Unflatten(FlatReader& r, _CaseEntry<std::allocator>& e) {
+    Unflatten(r, e.arguments);
+    Unflatten(r, e.input);
+    Unflatten(r, e.output);
+    Unflatten(r, e.output_expected);
+    Unflatten(r, e.result);
+}
+
+void Flatten(FlatWriter& w, const _FunctionEntry<std::allocator>& e) {
+    // Passing cases aren't described unless asked for, so their objects are sent without rendering them
+    bool details = !e.result || Test::report_passed_details_;
+    auto flatten_object = [&w, details](const std::optional<UserObject>& o) {
+        Flatten(w, o.has_value());
+        if(o)
+            Flatten(w, details ? *o : UserObject());
+    };
+    flatten_object(e.input);
+    flatten_object(e.output);
+    flatten_object(e.output_expected);
+    flatten_object(e.error);
+    flatten_object(e.error_expected);
+    flatten_object(e.arguments);
+    flatten_object(e.arguments_after);
+    flatten_object(e.arguments_after_expected);
+    flatten_object(e.return_value);
+    flatten_object(e.return_value_expected);
+    flatten_object(e.object);
+    flatten_object(e.object_after);
+    flatten_object(e.object_after_expected);
+    Flatten(w, e.max_run_time);
+    Flatten(w, e.run_time);
+    Flatten(w, e.run_time_stats);
+    Flatten(w, e.timeout);
+    Flatten(w, e.resource_usage);
+    Flatten(w, e.perf_counters);
+    Flatten(w, e.max_perf_counters);
+    Flatten(w, e.allocation_stats);
+    Flatten(w, e.max_allocations);
+    Flatten(w, e.max_peak_bytes);
+    Flatten(w, e.output_comparison);
+    Flatten(w, e.error_comparison);
+    Flatten(w, e.status);
+    Flatten(w, e.result);
+}
+void Unflatten(FlatReader& r, _FunctionEntry<std::allocator>& e) {
+    Unflatten(r, e.input);
+    Unflatten(r, e.output);
+    Unflatten(r, e.output_expected);
+    Unflatten(r, e.error);
+    Unflatten(r, e.error_expected);
+    Unflatten(r, e.arguments);
+    Unflatten(r, e.arguments_after);
+    Unflatten(r, e.arguments_after_expected);
+    Unflatten(r, e.return_value);
+    Unflatten(r, e.return_value_expected);
+    Unflatten(r, e.object);
+    Unflatten(r, e.object_after);
+    Unflatten(r, e.object_after_expected);
+    Unflatten(r, e.max_run_time);
+    Unflatten(r, e.run_time);
+    Unflatten(r, e.run_time_stats);
+    Unflatten(r, e.timeout);
+    Unflatten(r, e.resource_usage);
+    Unflatten(r, e.perf_counters);
+    Unflatten(r, e.max_perf_counters);
+    Unflatten(r, e.allocation_stats);
+    Unflatten(r, e.max_allocations);
+    Unflatten(r, e.max_peak_bytes);
+    Unflatten(r, e.output_comparison);
+    Unflatten(r, e.error_comparison);
+    Unflatten(r, e.status);
+    Unflatten(r, e.result);
+}
+
+void Flatten(FlatWriter& w, const ComplexityFit& f) {
+    Flatten(w, f.complexity);
+    Flatten(w, f.coefficient);
+    Flatten(w, f.error);
+}
+void Unflatten(FlatReader& r, ComplexityFit& f) {
+    Unflatten(r, f.complexity);
+    Unflatten(r, f.coefficient);
+    Unflatten(r, f.error);
+}
+
+void Flatten(FlatWriter& w, const _ComplexityData<std::allocator>& d) {
+    Flatten(w, d.sizes);
+    Flatten(w, d.run_times);
+    Flatten(w, d.bound);
+    Flatten(w, d.fits);
+    Flatten(w, d.result);
+}
+void Unflatten(FlatReader& r, _ComplexityData<std::allocator>& d) {
+    Unflatten(r, d.sizes);
+    Unflatten(r, d.run_times);
+    Unflatten(r, d.bound);
+    Unflatten(r, d.fits);
+    Unflatten(r, d.result);
+}
+
+void Flatten(FlatWriter& w, const _TestReport<std::allocator>& r) {
+    Flatten(w, r.info_stream.str());
+    Flatten(w, r.data.index());
+    std::visit([&w](auto& data) { Flatten(w, data); }, r.data);
+}
+void Unflatten(FlatReader& r, _TestReport<std::allocator>& report) {
+    std::string info;
+    Unflatten(r, info);
+    report.info_stream.str("");
+    report.info_stream << info;
+
+    size_t index;
+    Unflatten(r, index);
+    switch(index) {
+    case 0:
+        Unflatten(r, report.data.emplace<0>());
+        break;
+    case 1:
+        Unflatten(r, report.data.emplace<1>());
+        break;
+    case 2:
+        Unflatten(r, report.data.emplace<2>());
+        break;
+    case 3:
+        Unflatten(r, report.data.emplace<3>());
+        break;
+    case 4:
+        Unflatten(r, report.data.emplace<4>());
+        break;
+    case 5:
+        Unflatten(r, report.data.emplace<5>());
+        break;
+    default:
+        throw std::runtime_error("Invalid report type in flat data");
+    }
+}
+
+void Flatten(FlatWriter& w, const _TestData<std::allocator>& d) {
+    Flatten(w, d.reports.size());
+    for(auto& report : d.reports)
+        Flatten(w, report);
+    Flatten(w, d.grading_method);
+    Flatten(w, d.output_format);
+    Flatten(w, d.status);
+    Flatten(w, d.points);
+    Flatten(w, d.max_points);
+    Flatten(w, d.sout);
+    Flatten(w, d.serr);
+    Flatten(w, d.correct);
+    Flatten(w, d.incorrect);
+    Flatten(w, d.resource_usage);
+}
+void Unflatten(FlatReader& r, _TestData<std::allocator>& d) {
+    size_t size;
+    Unflatten(r, size);
+    d.reports.clear();
+    d.reports.reserve(size);
+    for(size_t i = 0; i < size; i++) {
+        // Reports have no default constructor, the type is replaced by Unflatten
+        auto& report = d.reports.emplace_back(_TestReport<std::allocator>::Make<_TrueData<std::allocator>>());
+        Unflatten(r, report);
+    }
+    Unflatten(r, d.grading_method);
+    Unflatten(r, d.output_format);
+    Unflatten(r, d.status);
+    Unflatten(r, d.points);
+    Unflatten(r, d.max_points);
+    Unflatten(r, d.sout);
+    Unflatten(r, d.serr);
+    Unflatten(r, d.correct);
+    Unflatten(r, d.incorrect);
+    Unflatten(r, d.resource_usage);
+}
+
+} // gcheck
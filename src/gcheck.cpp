@@ -4,17 +4,78 @@
 #include <fstream>
 #include <algorithm>
 #include <map>
+#include <set>
+#include <cstring>
 
 #include "argument.h"
 #include "redirectors.h"
 #include "console_writer.h"
 #include "shared_allocator.h"
+#include "scheduler.h"
+#include "message_pack.h"
+#include "random.h"
 
 namespace gcheck {
-// TODO: For some reason linker gives undefined reference errors without this.
-shared_manager asdnsadinasidnasikufbiusdbfg;
 
 namespace {
+    // Short human readable summary of the resources used by a run
+    std::string DescribeUsage(const ResourceUsage& u) {
+        std::stringstream ss;
+        ss.precision(3);
+        ss << "CPU " << u.user_time.count() << "s user " << u.system_time.count() << "s system, "
+           << "max RSS " << u.max_rss << " kB, "
+           << "page faults " << u.minor_faults << " minor " << u.major_faults << " major, "
+           << "context switches " << u.voluntary_switches << " voluntary " << u.involuntary_switches << " involuntary";
+        return ss.str();
+    }
+
+    std::string DescribeRunTimes(const RunTimeStats& s) {
+        return "median " + std::to_string(s.median.count()) + " ns, MAD " + std::to_string(s.mad.count())
+            + " ns, min " + std::to_string(s.minimum.count()) + " ns, p90 " + std::to_string(s.percentile90.count())
+            + " ns, " + std::to_string(s.samples) + " samples";
+    }
+
+    std::string DescribePerf(const PerfCounters& c) {
+        std::vector<std::string> parts;
+        if(c.instructions)
+            parts.push_back(std::to_string(*c.instructions) + " instructions");
+        if(c.cycles)
+            parts.push_back(std::to_string(*c.cycles) + " cycles");
+        if(c.cache_misses)
+            parts.push_back(std::to_string(*c.cache_misses) + " cache misses");
+        if(c.branch_misses)
+            parts.push_back(std::to_string(*c.branch_misses) + " branch misses");
+        if(c.task_clock)
+            parts.push_back("task clock " + std::to_string(c.task_clock->count()) + " ns");
+
+        std::string out;
+        for(auto& part : parts)
+            out += (out.empty() ? "" : ", ") + part;
+        return out;
+    }
+
+    std::string DescribeAllocations(const AllocationStats& s) {
+        return std::to_string(s.allocations) + " allocations of " + std::to_string(s.bytes) + " bytes, peak "
+            + std::to_string(s.peak_bytes) + " bytes, " + std::to_string(s.leaked_blocks) + " blocks of "
+            + std::to_string(s.leaked_bytes) + " bytes leaked";
+    }
+
+    std::string DescribeComparison(const OutputComparison& c) {
+        std::string out;
+        if(c.mismatch)
+            out = "differs at byte " + std::to_string(*c.mismatch) + ", shown from byte " + std::to_string(c.window);
+        if(c.truncated)
+            out += (out.empty() ? "" : ", ") + std::to_string(c.size) + " bytes written, cut off at the limit";
+        return out;
+    }
+
+    std::string DescribeFit(const ComplexityFit& f) {
+        std::stringstream ss;
+        ss.precision(3);
+        ss << ComplexityName(f.complexity) << ", " << f.coefficient << " ns * f(n), error " << f.error;
+        return ss.str();
+    }
+
     /*
         Static class for keeping track of and logging test results.
     */
@@ -32,11 +93,22 @@ namespace {
 
         Formatter() {}; //Disallows instantiation of this class
 
+        // The streamed report of an unfinished run, see AppendJSON
+        static std::ofstream report_;
+        static std::streamoff report_footer_; // Where the footer starts, the next state is written there
+        static std::streamoff report_end_;
+        static bool report_empty_;
+
         static void UpdateTestJSON(const std::string& suite, const std::string& test);
+        static void WriteTestState(const std::string& suite, const std::string& test);
+        static void AppendJSON(const std::string& suite, const std::string& test);
+        static void WriteResults(JsonWriter& writer);
         static void SaveJSON();
+        static void SaveBinary();
     public:
         static bool pretty_;
         static bool json_;
+        static bool binary_;
         static bool do_confirm_;
         static std::string filename_;
 
@@ -50,11 +122,16 @@ namespace {
     double Formatter::total_max_points_ = 0;
     bool Formatter::pretty_ = true;
     bool Formatter::json_ = false;
+    bool Formatter::binary_ = false;
     bool Formatter::do_confirm_ = true;
     std::string Formatter::filename_ = "report.json";
     std::string Formatter::default_format_ = "horizontal";
     std::map<std::string, Formatter::TestMap> Formatter::suites_;
     std::map<std::string, Formatter::TestMapJSON> Formatter::suites_json_;
+    std::ofstream Formatter::report_;
+    std::streamoff Formatter::report_footer_ = 0;
+    std::streamoff Formatter::report_end_ = 0;
+    bool Formatter::report_empty_ = true;
 
     void Formatter::UpdateTestJSON(const std::string& suite, const std::string& test) {
         suites_json_[suite][test] = JSON(*suites_[suite][test]);
@@ -67,20 +144,112 @@ namespace {
         total_max_points_ += data.max_points;
     }
 
-    void Formatter::SaveJSON() {
-        std::vector<std::pair<std::string, JSON>> output;
-        output.push_back({"test_results", suites_json_});
-        output.push_back({"points", JSON(total_points_)});
-        output.push_back({"max_points", JSON(total_max_points_)});
+    void Formatter::WriteTestState(const std::string& suite, const std::string& test) {
+        std::string state = report_empty_ ? "\n" : ",\n";
+        JsonWriter(state).BeginObject()
+            .Member("suite", suite)
+            .Member("test", test)
+            .Member("result", suites_json_[suite][test])
+            .EndObject();
+
+        report_.seekp(report_footer_);
+        report_ << state;
+        report_footer_ = report_.tellp();
+        report_empty_ = false;
+    }
+
+    /*
+        While the tests are running, the report is a list of the states of the tests, where the last state of each test
+        counts. The states are only appended, and the footer after them is rewritten each time, so that the file is
+        valid JSON even if the run crashes, without rewriting the whole report for each test. The report is written in
+        the usual format once all the tests are done.
+    */
+    void Formatter::AppendJSON(const std::string& suite, const std::string& test) {
+        if(!report_.is_open()) {
+            report_.open(filename_, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+            report_ << "{\"partial\":true,\"seed\":" << GetRandomSeed() << ",\"tests\":[";
+            report_footer_ = report_end_ = report_.tellp();
+            report_empty_ = true;
+
+            // The tests that haven't started yet are listed too
+            for(auto& [suite_name, tests] : suites_json_)
+                for(auto& test_json : tests)
+                    WriteTestState(suite_name, test_json.first);
+        } else {
+            WriteTestState(suite, test);
+        }
+
+        report_ << "\n],\"points\":" << JSON(total_points_) << ",\"max_points\":" << JSON(total_max_points_) << "}\n";
+        // Whitespace covers what's left of a longer footer
+        std::streamoff end = report_.tellp();
+        if(end < report_end_)
+            report_ << std::string(report_end_ - end, ' ');
+        else
+            report_end_ = end;
+        report_.flush();
+    }
 
-        std::fstream file(filename_, std::ios_base::out);
+    void Formatter::WriteResults(JsonWriter& writer) {
+        // The JSON of the tests is kept for the partial reports, the binary report encodes the results directly
+        if(writer.GetEncoding() == JsonWriter::MessagePack) {
+            writer.Key("test_results").BeginObject();
+            for(auto& [suite, tests] : suites_) {
+                writer.Key(suite).BeginObject();
+                for(auto& [test, data] : tests)
+                    writer.Member(test, *data);
+                writer.EndObject();
+            }
+            writer.EndObject();
+        } else {
+            writer.Member("test_results", suites_json_);
+        }
+        writer.Member("seed", GetRandomSeed())
+            .Member("points", total_points_)
+            .Member("max_points", total_max_points_);
+    }
 
-        file << JSON(output) << std::endl << std::endl;
+    void Formatter::SaveJSON() {
+        std::string output;
+        JsonWriter writer(output);
+        writer.BeginObject();
+        WriteResults(writer);
+        writer.EndObject();
+        output += "\n\n";
+
+        std::ofstream file(filename_, std::ios_base::out | std::ios_base::binary);
+        file.write(output.data(), output.size());
+    }
 
-        file.close();
+    /*
+        The same object model as the JSON report with a schema version, written as MessagePack. Saved next to the JSON
+        report, with .msgpack in place of its .json extension.
+    */
+    void Formatter::SaveBinary() {
+        std::string output;
+        JsonWriter writer(output, JsonWriter::MessagePack);
+        writer.BeginObject().Member("schema_version", binary_report_version);
+        WriteResults(writer);
+        writer.EndObject();
+
+        std::string filename = filename_;
+        if(filename.size() >= 5 && filename.compare(filename.size() - 5, 5, ".json") == 0)
+            filename.resize(filename.size() - 5);
+        if(filename.size() < 8 || filename.compare(filename.size() - 8, 8, ".msgpack") != 0)
+            filename += ".msgpack";
+
+        std::ofstream file(filename, std::ios_base::out | std::ios_base::binary);
+        file.write(output.data(), output.size());
     }
 
     void Formatter::Finish() {
+        if(json_) {
+            if(report_.is_open())
+                report_.close();
+            SaveJSON();
+        }
+        if(binary_)
+            SaveBinary();
+
         if(pretty_) {
             ConsoleWriter writer;
             writer.WriteSeparator();
@@ -89,6 +258,8 @@ namespace {
             std::cout << total_points_ << " / " << total_max_points_;
             writer.SetColor(ConsoleWriter::Black);
             std::cout << std::endl;
+            // Running with --seed and this replays the random arguments
+            std::cout << "Random seed: " << GetRandomSeed() << std::endl;
 
             if(do_confirm_) {
                 // Wait for user confirmation
@@ -109,7 +280,7 @@ namespace {
 
         if(json_) {
             UpdateTestJSON(suite, test);
-            SaveJSON();
+            AppendJSON(suite, test);
         }
 
         if(pretty_) {
@@ -129,7 +300,7 @@ namespace {
 
         if(json_) {
             UpdateTestJSON(suite, test);
-            SaveJSON();
+            AppendJSON(suite, test);
         }
 
         if(pretty_) {
@@ -140,6 +311,8 @@ namespace {
             writer.SetColor(test_data.points == test_data.max_points ? ConsoleWriter::Green : ConsoleWriter::Red);
             std::cout << test_data.points << " / " << test_data.max_points << "  suite: " << suite << ", test: " << test << std::endl;
             writer.SetColor(ConsoleWriter::Black);
+            if(test_data.resource_usage)
+                std::cout << "Resources: " << DescribeUsage(*test_data.resource_usage) << std::endl;
 
             for(auto it = test_data.reports.begin(); it != test_data.reports.end(); it++) {
                 std::vector<std::vector<std::string>> cells;
@@ -196,11 +369,12 @@ namespace {
                     for(auto it2 = d->begin(); it2 != d->end(); it2++) {
                         cells.push_back({});
                         auto& row = cells[cells.size()-1];
+                        std::string usage = it2->resource_usage ? " (" + DescribeUsage(*it2->resource_usage) + ")" : "";
                         if(it2->status == TIMEDOUT) {
-                            row.push_back("Timed out");
+                            row.push_back("Timed out" + usage);
                             continue;
                         } else if(it2->status == ERROR) {
-                            row.push_back("Crashed");
+                            row.push_back("Crashed" + usage);
                             continue;
                         }
                         row.push_back(it2->result ? "correct" : "incorrect");
@@ -208,13 +382,27 @@ namespace {
                             row.push_back(str);
                             if(!headers_filled) headers.push_back(header);
                         };
-                        auto add_if = [&add, &headers, &row, headers_filled](const std::optional<UserObject>& i, const std::string& header) {
-                            if(i) add(i->string(), header);
+                        // Passing cases are described only when asked for, so that their objects are never rendered
+                        bool details = !it2->result || Test::report_passed_details_;
+                        auto add_if = [&add, details](const std::optional<UserObject>& i, const std::string& header) {
+                            if(i) add(details ? i->string() : "", header);
                         };
                         if(it2->max_run_time) {
                             add(std::to_string(it2->max_run_time->count()), "Max Run Time");
                             add(std::to_string(it2->run_time.count()), "Run Time");
                         }
+                        if(it2->run_time_stats)
+                            add(DescribeRunTimes(*it2->run_time_stats), "Run Time Samples");
+                        if(it2->max_perf_counters)
+                            add(DescribePerf(*it2->max_perf_counters), "Max Counters");
+                        if(it2->perf_counters)
+                            add(DescribePerf(*it2->perf_counters), "Counters");
+                        if(it2->max_allocations)
+                            add(std::to_string(*it2->max_allocations), "Max Allocations");
+                        if(it2->max_peak_bytes)
+                            add(std::to_string(*it2->max_peak_bytes), "Max Peak Bytes");
+                        if(it2->allocation_stats)
+                            add(DescribeAllocations(*it2->allocation_stats), "Allocations");
                         add_if(it2->object, "Object");
                         add_if(it2->object_after, "Object Afterwards");
                         add_if(it2->object_after_expected, "Correct Object Afterwards");
@@ -224,14 +412,34 @@ namespace {
                         add_if(it2->input, "Standard Input");
                         add_if(it2->output, "Standard Output");
                         add_if(it2->output_expected, "Expected Output");
+                        if(it2->output_comparison)
+                            add(DescribeComparison(*it2->output_comparison), "Output Mismatch");
                         add_if(it2->error, "Standard Error");
                         add_if(it2->error_expected, "Expected Error");
+                        if(it2->error_comparison)
+                            add(DescribeComparison(*it2->error_comparison), "Error Mismatch");
                         add_if(it2->arguments_after, "Arguments Afterwards");
                         add_if(it2->arguments_after_expected, "Correct Arguments Afterwards");
+                        if(it2->resource_usage)
+                            add(DescribeUsage(*it2->resource_usage), "Resources");
 
                         headers_filled = true;
                     }
                     writer.SetHeaders(headers);
+                } else if(const auto d = std::get_if<ComplexityData>(&it->data)) {
+
+                    cells.push_back({});
+                    auto& row = cells[cells.size()-1];
+                    std::string points;
+                    for(size_t i = 0; i < d->sizes.size(); i++)
+                        points += (i ? ", " : "") + std::to_string(d->sizes[i]) + ": " + std::to_string(d->run_times[i].count()) + " ns";
+                    row.push_back(d->result ? "correct" : "incorrect");
+                    row.push_back(ComplexityName(d->bound));
+                    row.push_back(d->fits.empty() ? "Too few sizes" : DescribeFit(d->fits.front()));
+                    row.push_back(points);
+                    row.push_back(it->info_stream.str());
+
+                    writer.SetHeaders({"Result", "Bound", "Fitted", "Run Times", "Info"});
                 } else {
 
                     cells.push_back({});
@@ -314,12 +522,19 @@ void Prerequisite::FetchTests() {
 double TestInfo::default_points = 1;
 
 bool Test::do_safe_run_ = false;
+bool Test::use_fork_server_ = false;
+size_t Test::default_safe_batch_size_ = 1;
+int Test::jobs_ = 1;
+bool Test::report_passed_details_ = false;
 
 Test::Test(const TestInfo& info) : data_(info.max_points, info.prerequisite), suite_(info.suite), test_(info.test) {
     test_list_().push_back(this);
+    test_index_().emplace(suite_ + "." + test_, this);
 }
 
 void Test::RunTest() {
+    SetRandomRun(suite_, test_, 0);
+
     StdoutCapturer tout;
     StderrCapturer terr;
 
@@ -352,6 +567,8 @@ TestReport& Test::AddReport(TestReport& report) {
         for(auto it = cases->begin(); it != cases->end(); it++) {
             increment_correct(it->result);
         }
+    } else if(const auto d = std::get_if<ComplexityData>(&report.data)) {
+        increment_correct(d->result);
     } else {
         // this should never be run
         throw std::exception();
@@ -361,6 +578,21 @@ TestReport& Test::AddReport(TestReport& report) {
     return data_.reports[data_.reports.size()-1];
 }
 
+void Test::ReportUnfinished(TestData& data, TestStatus status, const std::string& reason) {
+    TestReport report = TestReport::Make<TrueData>();
+    auto& entry = report.Get<TrueData>();
+    entry.value = false;
+    entry.descriptor = reason;
+    entry.result = false;
+
+    data.reports.push_back(report);
+    data.incorrect++;
+    data.status = status;
+    data.CalculatePoints();
+
+    std::cerr << suite_ << "." << test_ << ": " << reason << std::endl;
+}
+
 void Test::SetGradingMethod(gcheck::GradingMethod method) {
     data_.grading_method = method;
 }
@@ -373,6 +605,103 @@ bool Test::IsPassed() const {
     return data_.status == Finished && data_.max_points == data_.points;
 }
 
+unsigned int Test::RunSerial(TestScheduler& scheduler) {
+    unsigned int counter = 0;
+    while(!scheduler.Empty()) {
+        size_t index = scheduler.Pop();
+        Test* test = scheduler.GetTest(index);
+
+        test->data_.status = Started;
+        Formatter::StartTest(test->suite_, test->test_);
+        test->RunTest();
+        Formatter::FinishTest(test->suite_, test->test_);
+
+        scheduler.Finish(index, test->IsPassed());
+        counter++;
+    }
+    return counter;
+}
+
+unsigned int Test::RunParallel(TestScheduler& scheduler) {
+#if defined(__linux__)
+    struct Worker {
+        size_t index;
+        std::unique_ptr<shared_manager> memory;
+    };
+    std::map<pid_t, Worker> workers;
+    ChildSupervisor supervisor;
+    std::set<TestScheduler::Key> running;
+    // Results waiting for the tests before them to be reported
+    std::map<TestScheduler::Key, std::pair<size_t, TestData>> finished;
+
+    // Buffered output would otherwise be written by the workers too
+    std::cout.flush();
+    fflush(stdout);
+    fflush(stderr);
+
+    unsigned int counter = 0;
+    while(!scheduler.Empty() || !workers.empty() || !finished.empty()) {
+        while(!scheduler.Empty() && workers.size() < (size_t)jobs_) {
+            size_t index = scheduler.Pop();
+            Test* test = scheduler.GetTest(index);
+            test->data_.status = Started;
+
+            auto memory = std::make_unique<shared_manager>(shared_manager::limit_);
+            pid_t pid = StartForked(*memory, test->data_, [test](){ test->RunTest(); });
+            if(pid < 0)
+                throw std::runtime_error("Unable to fork a worker: " + std::string(strerror(errno)));
+
+            supervisor.Add(pid, std::chrono::duration<double>::zero());
+            running.insert(scheduler.GetKey(index));
+            workers.emplace(pid, Worker{index, std::move(memory)});
+        }
+
+        // Report the results in the same order as a serial run. Tests that aren't ready yet depend on a running or
+        // a ready test, so they come after them.
+        while(!finished.empty()) {
+            auto first = finished.begin();
+            if((!running.empty() && *running.begin() < first->first)
+                    || (!scheduler.Empty() && scheduler.NextKey() < first->first))
+                break;
+
+            Test* test = scheduler.GetTest(first->second.first);
+            Formatter::StartTest(test->suite_, test->test_);
+            test->data_ = first->second.second;
+            Formatter::FinishTest(test->suite_, test->test_);
+
+            finished.erase(first);
+            counter++;
+        }
+
+        if(workers.empty())
+            continue;
+
+        auto exit = supervisor.Wait();
+        auto it = workers.find(exit.pid);
+        size_t index = it->second.index;
+        Test* test = scheduler.GetTest(index);
+        TestData result = test->data_;
+        ForkStatus status = exit.status == TIMEDOUT ? TIMEDOUT : FinishForked(*it->second.memory, exit.wait_status, result);
+        workers.erase(it);
+        if(status != OK)
+            result.resource_usage = exit.usage;
+        if(status == TIMEDOUT)
+            test->ReportUnfinished(result, TimedOut, "Timed out");
+        else if(status == ERROR)
+            test->ReportUnfinished(result, Crashed, "Crashed: " + DescribeExit(exit.wait_status));
+
+        running.erase(scheduler.GetKey(index));
+        scheduler.Finish(index, result.status == Finished && result.max_points == result.points);
+        finished.emplace(scheduler.GetKey(index), std::pair(index, result));
+    }
+
+    return counter;
+#else
+    (void)scheduler;
+    throw std::runtime_error("Parallel running is only supported on linux.");
+#endif
+}
+
 bool Test::RunTests() {
 
     const auto& test_list = test_list_();
@@ -381,20 +710,8 @@ bool Test::RunTests() {
         Formatter::AddTest((*it)->suite_, (*it)->test_, (*it)->data_);
     }
 
-    unsigned int counter, finished = 0;
-    do {
-        counter = 0;
-        for(auto it = test_list.begin(); it != test_list.end(); it++) {
-            if((*it)->data_.status == NotStarted && (*it)->data_.prerequisite.IsFulfilled()) {
-                (*it)->data_.status = Started;
-                Formatter::StartTest((*it)->suite_, (*it)->test_);
-                (*it)->RunTest();
-                Formatter::FinishTest((*it)->suite_, (*it)->test_);
-                counter++;
-                finished++;
-            }
-        }
-    } while(counter != 0);
+    TestScheduler scheduler(test_list);
+    unsigned int finished = jobs_ > 1 ? RunParallel(scheduler) : RunSerial(scheduler);
 
     Formatter::Finish();
 
@@ -402,12 +719,9 @@ bool Test::RunTests() {
 }
 
 Test* Test::FindTest(std::string suite, std::string test) {
-    std::vector<Test*>& tests = test_list_();
-    for(Test* t : tests)
-        if(t->suite_ == suite && t->test_ == test)
-            return t;
-
-    return nullptr;
+    auto& index = test_index_();
+    auto it = index.find(suite + "." + test);
+    return it == index.end() ? nullptr : it->second;
 }
 
 } // gcheck
@@ -425,15 +739,28 @@ int main(int argc, char** argv) {
     while(i < argc) {
         auto param = next_param();
         if(param == std::string("--json")) Formatter::json_ = true;
+        else if(param == std::string("--binary")) Formatter::binary_ = true;
         else if(param == std::string("--pretty")) Formatter::pretty_ = true;
         else if(param == std::string("--no-confirm")) Formatter::do_confirm_ = false;
         else if(param == std::string("--safe")) Test::do_safe_run_ = true;
+        else if(param == std::string("--fork-server")) Test::do_safe_run_ = Test::use_fork_server_ = true;
+        else if(param == std::string("--safe-batch")) Test::default_safe_batch_size_ = std::stoul(next_param());
+        else if(param == std::string("--shared-memory")) shared_manager::limit_ = std::stoul(next_param())*1024*1024;
+        else if(param == std::string("--jobs")) Test::jobs_ = std::stoi(next_param());
+        else if(param == std::string("--details")) Test::report_passed_details_ = true;
         else if(param == std::string("--width")) ConsoleWriter::width_ = std::stoi(next_param());
+        else if(param == std::string("--seed")) SetRandomSeed(std::stoull(next_param()));
+        else if(param == std::string("--cell-limit")) ConsoleWriter::max_cell_length_ = std::stoul(next_param());
         else if(strncmp(param, "--", 2) == 0) throw std::runtime_error(std::string("Argument not recognized: ") + param);
         else Formatter::filename_ = param;
     }
-    if(!Formatter::pretty_ && !Formatter::json_) Formatter::pretty_ = true;
-    if(Formatter::json_ && Formatter::filename_ == "") Formatter::filename_ = "report.json";
+    if(!Formatter::pretty_ && !Formatter::json_ && !Formatter::binary_) Formatter::pretty_ = true;
+    if(Test::default_safe_batch_size_ > 1) Test::do_safe_run_ = true;
+    if((Formatter::json_ || Formatter::binary_) && Formatter::filename_ == "") Formatter::filename_ = "report.json";
+    // Tools reading the reports expect the details of every case
+    if(Formatter::json_ || Formatter::binary_) Test::report_passed_details_ = true;
+    // Chosen before any tests are forked, so that they all use the same seed
+    GetRandomSeed();
 
     Test::RunTests();
 
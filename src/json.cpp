@@ -10,18 +10,55 @@
 
 namespace gcheck {
 
+namespace {
+    // Number with significant digits instead of the fixed six decimals of std::to_string
+    void number(JsonWriter& writer, double value) {
+        if(writer.GetEncoding() == JsonWriter::MessagePack) {
+            writer.Number(value);
+            return;
+        }
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+        writer.Raw(buffer);
+    }
+} // anonymous
+
+JsonWriter& JsonWriter::Key(std::string_view key) {
+    Separate();
+    if(encoding_ == MessagePack) {
+        MessagePackEncoder(out_).String(key);
+        first_ = true;
+        return *this;
+    }
+    out_ += '"';
+    JSONEscape(key, out_);
+    out_ += "\":";
+    first_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(std::string_view str) {
+    Separate();
+    if(encoding_ == MessagePack) {
+        MessagePackEncoder(out_).String(str);
+        return *this;
+    }
+    out_ += '"';
+    JSONEscape(str, out_);
+    out_ += '"';
+    return *this;
+}
+
 _JSON<std::allocator> _JSON<std::allocator>::Escape(std::string str) {
     _JSON json;
     return json.Set(JSONEscape(str));
 }
 
-_JSON<std::allocator>::_JSON(const char* str) : _JSON(JSONEscape(str)) {}
-
-_JSON<std::allocator>::_JSON(const _FunctionEntry<std::allocator>& e) {
-    std::vector<_JSON> data;
-    auto add_if = [&data](const std::string& str, auto a) {
-        if(a) data.emplace_back(str, *a);
+JsonWriter& JsonWriter::Value(const _FunctionEntry<std::allocator>& e) {
+    auto add_if = [this](const char* key, const auto& a) {
+        if(a) Member(key, *a);
     };
+    BeginObject();
     add_if("input", e.input);
     add_if("output", e.output);
     add_if("output_expected", e.output_expected);
@@ -35,145 +72,232 @@ _JSON<std::allocator>::_JSON(const _FunctionEntry<std::allocator>& e) {
     add_if("object", e.object);
     add_if("object_after", e.object_after);
     add_if("object_after_expected", e.object_after_expected);
-    data.emplace_back("run_time", e.run_time.count());
-    data.emplace_back("timeout", e.timeout.count());
-    data.emplace_back("status", e.status);
-    data.emplace_back("result", e.result);
-
-    Set(Stringify(data, [](const _JSON& a) -> std::string { return a; }, "{", ",", "}"));
+    Member("run_time", e.run_time.count());
+    add_if("run_time_stats", e.run_time_stats);
+    Member("timeout", e.timeout.count());
+    add_if("resource_usage", e.resource_usage);
+    add_if("perf_counters", e.perf_counters);
+    add_if("max_perf_counters", e.max_perf_counters);
+    add_if("allocation_stats", e.allocation_stats);
+    add_if("max_allocations", e.max_allocations);
+    add_if("max_peak_bytes", e.max_peak_bytes);
+    add_if("output_comparison", e.output_comparison);
+    add_if("error_comparison", e.error_comparison);
+    Member("status", e.status);
+    Member("result", e.result);
+    return EndObject();
 }
 
-_JSON<std::allocator>::_JSON(const _UserObject<std::allocator>& o)
-        : _JSON(std::vector{
-            std::pair("json", o.json()),
+JsonWriter& JsonWriter::Value(const _UserObject<std::allocator>& o) {
+    BeginObject();
+    Member("json", o.json());
 #ifdef GCHECK_CONSTRUCT_DATA
-            std::pair("construct", _JSON(o.construct())),
+    Member("construct", o.construct());
 #endif
-            std::pair("string", _JSON(o.string())),
-        }) {}
+    Member("string", o.string());
+    return EndObject();
+}
 
-_JSON<std::allocator>::_JSON(const _CaseEntry<std::allocator>& e) {
-    std::vector<_JSON> data;
-    auto add_if = [&data](const std::string& str, auto a) {
-        if(a) data.emplace_back(str, *a);
+JsonWriter& JsonWriter::Value(const _CaseEntry<std::allocator>& e) {
+    auto add_if = [this](const char* key, const auto& a) {
+        if(a) Member(key, *a);
     };
+    BeginObject();
     add_if("input", e.input);
     add_if("output", e.output);
     add_if("output_expected", e.output_expected);
     add_if("arguments", e.arguments);
-    data.emplace_back("result", e.result);
+    Member("result", e.result);
+    return EndObject();
+}
+
+JsonWriter& JsonWriter::Value(const ResourceUsage& u) {
+    return BeginObject()
+        .Member("user_time", u.user_time.count())
+        .Member("system_time", u.system_time.count())
+        .Member("max_rss", u.max_rss)
+        .Member("minor_faults", u.minor_faults)
+        .Member("major_faults", u.major_faults)
+        .Member("voluntary_context_switches", u.voluntary_switches)
+        .Member("involuntary_context_switches", u.involuntary_switches)
+        .EndObject();
+}
+
+JsonWriter& JsonWriter::Value(const RunTimeStats& s) {
+    return BeginObject()
+        .Member("samples", s.samples)
+        .Member("minimum", s.minimum.count())
+        .Member("maximum", s.maximum.count())
+        .Member("mean", s.mean.count())
+        .Member("median", s.median.count())
+        .Member("percentile90", s.percentile90.count())
+        .Member("percentile99", s.percentile99.count())
+        .Member("mad", s.mad.count())
+        .Member("statistic", s.statistic)
+        .EndObject();
+}
+
+JsonWriter& JsonWriter::Value(const RunTimeStatistic& s) {
+    switch(s) {
+    case Minimum:
+        return String("minimum");
+    case Mean:
+        return String("mean");
+    case Percentile90:
+        return String("percentile90");
+    case Median:
+    default:
+        return String("median");
+    }
+}
+
+JsonWriter& JsonWriter::Value(const Complexity& c) { return String(ComplexityName(c)); }
+
+JsonWriter& JsonWriter::Value(const ComplexityFit& f) {
+    BeginObject();
+    Member("complexity", f.complexity);
+    Key("coefficient");
+    number(*this, f.coefficient);
+    Key("error");
+    number(*this, f.error);
+    return EndObject();
+}
 
-    Set(Stringify(data, [](const _JSON& a) -> std::string { return a; }, "{", ",", "}"));
+JsonWriter& JsonWriter::Value(const AllocationStats& s) {
+    return BeginObject()
+        .Member("allocations", s.allocations)
+        .Member("bytes", s.bytes)
+        .Member("peak_bytes", s.peak_bytes)
+        .Member("leaked_blocks", s.leaked_blocks)
+        .Member("leaked_bytes", s.leaked_bytes)
+        .EndObject();
 }
 
-_JSON<std::allocator>::_JSON(const ForkStatus& s) {
+JsonWriter& JsonWriter::Value(const OutputComparison& c) {
+    BeginObject();
+    Member("size", c.size);
+    if(c.mismatch)
+        Member("mismatch", *c.mismatch);
+    Member("truncated", c.truncated);
+    Member("window", c.window);
+    return EndObject();
+}
+
+JsonWriter& JsonWriter::Value(const PerfCounters& c) {
+    // Counters that weren't available are left out
+    BeginObject();
+    if(c.instructions)
+        Member("instructions", *c.instructions);
+    if(c.cycles)
+        Member("cycles", *c.cycles);
+    if(c.cache_misses)
+        Member("cache_misses", *c.cache_misses);
+    if(c.branch_misses)
+        Member("branch_misses", *c.branch_misses);
+    if(c.task_clock)
+        Member("task_clock", c.task_clock->count());
+    return EndObject();
+}
+
+JsonWriter& JsonWriter::Value(const ForkStatus& s) {
     switch(s) {
     case OK:
-        Set("\"OK\"");
-        break;
+        return String("OK");
     case TIMEDOUT:
-        Set("\"TIMEDOUT\"");
-        break;
+        return String("TIMEDOUT");
     case ERROR:
     default:
-        Set("\"ERROR\"");
-        break;
+        return String("ERROR");
     }
 }
 
-_JSON<std::allocator>::_JSON(const _TestReport<std::allocator>& r) {
-
-    std::string out = "{";
+JsonWriter& JsonWriter::Value(const _TestReport<std::allocator>& r) {
+    BeginObject();
     if(const auto d = std::get_if<EqualsData>(&r.data)) {
-        out += _JSON("type", "EE") + ',';
-
-        out += _JSON("output_expected", d->output_expected.string()) + ',';
-        out += _JSON("output", d->output.string()) + ',';
-        out += _JSON("result", d->result) + ',';
-        out += _JSON("descriptor", d->descriptor) + ',';
+        Member("type", "EE");
+        Member("output_expected", d->output_expected.string());
+        Member("output", d->output.string());
+        Member("result", d->result);
+        Member("descriptor", d->descriptor);
     } else if(const auto d = std::get_if<TrueData>(&r.data)) {
-        out += _JSON("type", "ET") + ',';
-
-        out += _JSON("value", d->value) + ',';
-        out += _JSON("result", d->result) + ',';
-        out += _JSON("descriptor", d->descriptor) + ',';
+        Member("type", "ET");
+        Member("value", d->value);
+        Member("result", d->result);
+        Member("descriptor", d->descriptor);
     } else if(const auto d = std::get_if<FalseData>(&r.data)) {
-        out += _JSON("type", "EF") + ',';
-
-        out += _JSON("value", d->value) + ',';
-        out += _JSON("result", d->result) + ',';
-        out += _JSON("descriptor", d->descriptor) + ',';
+        Member("type", "EF");
+        Member("value", d->value);
+        Member("result", d->result);
+        Member("descriptor", d->descriptor);
     } else if(const auto d = std::get_if<CaseData>(&r.data)) {
-        out += _JSON("type", "TC") + ',';
-
-        out += _JSON("cases", *d) + ',';
+        Member("type", "TC");
+        Member("cases", *d);
     } else if(const auto d = std::get_if<FunctionData>(&r.data)) {
-        out += _JSON("type", "FC") + ',';
-
-        out += _JSON("cases", *d) + ',';
+        Member("type", "FC");
+        Member("cases", *d);
+    } else if(const auto d = std::get_if<ComplexityData>(&r.data)) {
+        Member("type", "CX");
+        Member("sizes", d->sizes);
+        Key("run_times").BeginArray();
+        for(auto& t : d->run_times)
+            Value(t.count());
+        EndArray();
+        Member("bound", d->bound);
+        Member("fits", d->fits);
+        Member("result", d->result);
     }
-    out += _JSON("info", r.info_stream.str());
-    out += "}";
-
-    Set(out);
+    Member("info", r.info_stream.str());
+    return EndObject();
 }
 
-_JSON<std::allocator>::_JSON(const TestStatus& status) {
+JsonWriter& JsonWriter::Value(const TestStatus& status) {
     switch (status) {
     case TestStatus::NotStarted:
-        *this = _JSON("NotStarted");
-        break;
+        return String("NotStarted");
     case TestStatus::Started:
-        *this = _JSON("Started");
-        break;
+        return String("Started");
     case TestStatus::TimedOut:
-        *this = _JSON("TimedOut");
-        break;
+        return String("TimedOut");
     case TestStatus::Finished:
-        *this = _JSON("Finished");
-        break;
+        return String("Finished");
+    case TestStatus::Crashed:
+        return String("Crashed");
     default:
-        *this = _JSON("ERROR");
-        break;
+        return String("ERROR");
     }
 }
 
-_JSON<std::allocator>::_JSON(const _TestData<std::allocator>& data) {
-
-    std::string out = "{";
-    out += _JSON("results", data.reports) + ',';
-    out += _JSON("grading_method", data.grading_method) + ',';
-    out += _JSON("prerequisite", data.prerequisite) + ',';
-    out += _JSON("format", data.output_format) + ',';
-    out += _JSON("points", data.points) + ',';
-    out += _JSON("max_points", data.max_points) + ',';
-    out += _JSON("stdout", data.sout) + ',';
-    out += _JSON("stderr", data.serr) + ',';
-    out += _JSON("correct", data.correct) + ',';
-    out += _JSON("incorrect", data.incorrect) + ',';
-    out += _JSON("status", data.status);
-    out += "}";
-
-    Set(out);
-}
-
-_JSON<std::allocator>::_JSON(const Prerequisite& pre) {
-    auto v = pre.GetFullfillmentData();
-    std::vector<std::tuple<std::pair<std::string, std::string>,std::pair<std::string, std::string>, std::pair<std::string, bool>>> v2(v.size());
-    std::transform(v.begin(), v.end(), v2.begin(),
-        [](const std::tuple<std::string, std::string, bool>& t) {
-            return std::tuple(
-                std::pair("suite", std::get<0>(t)),
-                std::pair("test", std::get<1>(t)),
-                std::pair("isfullfilled", std::get<2>(t))
-            );
-        });
-
-    std::string out = "{";
-    out += _JSON("isfullfilled", pre.IsFulfilled()) + ',';
-    out += _JSON("details", v2);
-    out += "}";
-    Set(out);
+JsonWriter& JsonWriter::Value(const _TestData<std::allocator>& data) {
+    BeginObject()
+        .Member("results", data.reports)
+        .Member("grading_method", data.grading_method)
+        .Member("prerequisite", data.prerequisite)
+        .Member("format", data.output_format)
+        .Member("points", data.points)
+        .Member("max_points", data.max_points)
+        .Member("stdout", data.sout)
+        .Member("stderr", data.serr)
+        .Member("correct", data.correct)
+        .Member("incorrect", data.incorrect)
+        .Member("status", data.status);
+    if(data.resource_usage)
+        Member("resource_usage", *data.resource_usage);
+    return EndObject();
+}
+
+JsonWriter& JsonWriter::Value(const Prerequisite& pre) {
+    BeginObject();
+    Member("isfullfilled", pre.IsFulfilled());
+    Key("details").BeginArray();
+    for(auto& [suite, test, fulfilled] : pre.GetFullfillmentData()) {
+        BeginObject()
+            .Member("suite", suite)
+            .Member("test", test)
+            .Member("isfullfilled", fulfilled)
+            .EndObject();
+    }
+    EndArray();
+    return EndObject();
 }
 
 template _JSON<std::allocator>::_JSON(const std::string& key, const int& value);
@@ -0,0 +1,287 @@
+#include "message_pack.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace gcheck {
+
+namespace {
+    /*
+        MessagePack needs the lengths of arrays and maps before their items, so the JSON is first parsed into a flat
+        list of tokens where the length of a container is filled in when it's closed, and then encoded in order.
+    */
+    struct Token {
+        enum Type { Nil, False, True, Int, UInt, Float, String, Array, Map };
+
+        Token(Type type) : type(type), u(0) {}
+
+        Type type;
+        union {
+            int64_t i;
+            uint64_t u;
+            double f;
+            size_t count; // Items of an array, pairs of a map
+        };
+        size_t offset = 0; // Of a string in the unescaped strings
+        size_t length = 0;
+    };
+
+    class Parser {
+    public:
+        Parser(std::string_view json) : json_(json) {}
+
+        void Parse() {
+            Value();
+            SkipSpace();
+            if(pos_ != json_.size())
+                Fail("trailing characters");
+        }
+
+        std::vector<Token> tokens;
+        std::string strings;
+    private:
+        [[noreturn]] void Fail(const char* what) {
+            throw std::runtime_error("Malformed JSON at " + std::to_string(pos_) + ": " + what);
+        }
+
+        void SkipSpace() {
+            while(pos_ < json_.size() && (json_[pos_] == ' ' || json_[pos_] == '\n' || json_[pos_] == '\r' || json_[pos_] == '\t'))
+                pos_++;
+        }
+
+        bool Consume(std::string_view word) {
+            if(json_.substr(pos_, word.size()) != word)
+                return false;
+            pos_ += word.size();
+            return true;
+        }
+
+        void Value() {
+            SkipSpace();
+            if(pos_ == json_.size())
+                Fail("unexpected end");
+
+            char c = json_[pos_];
+            if(c == '{') Container('}', Token::Map);
+            else if(c == '[') Container(']', Token::Array);
+            else if(c == '"') String();
+            else if(Consume("null")) tokens.push_back({Token::Nil});
+            else if(Consume("true")) tokens.push_back({Token::True});
+            else if(Consume("false")) tokens.push_back({Token::False});
+            else Number();
+        }
+
+        void Container(char close, Token::Type type) {
+            pos_++;
+            size_t index = tokens.size();
+            tokens.push_back({type});
+            tokens[index].count = 0;
+
+            SkipSpace();
+            if(pos_ < json_.size() && json_[pos_] == close) {
+                pos_++;
+                return;
+            }
+
+            size_t count = 0;
+            while(true) {
+                if(type == Token::Map) {
+                    SkipSpace();
+                    if(pos_ == json_.size() || json_[pos_] != '"')
+                        Fail("expected a key");
+                    String();
+                    SkipSpace();
+                    if(pos_ == json_.size() || json_[pos_] != ':')
+                        Fail("expected ':'");
+                    pos_++;
+                }
+                Value();
+                count++;
+
+                SkipSpace();
+                if(pos_ == json_.size())
+                    Fail("unexpected end");
+                if(json_[pos_] == close) {
+                    pos_++;
+                    break;
+                }
+                if(json_[pos_] != ',')
+                    Fail("expected ','");
+                pos_++;
+            }
+            tokens[index].count = count;
+        }
+
+        unsigned Hex4() {
+            if(pos_ + 4 > json_.size())
+                Fail("truncated \\u escape");
+            unsigned value = 0;
+            for(int i = 0; i < 4; i++) {
+                char c = json_[pos_++];
+                value <<= 4;
+                if(c >= '0' && c <= '9') value |= c - '0';
+                else if(c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+                else if(c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+                else Fail("invalid \\u escape");
+            }
+            return value;
+        }
+
+        void AppendUTF8(uint32_t code) {
+            if(code < 0x80) {
+                strings += (char)code;
+            } else if(code < 0x800) {
+                strings += (char)(0xC0 | (code >> 6));
+                strings += (char)(0x80 | (code & 0x3F));
+            } else if(code < 0x10000) {
+                strings += (char)(0xE0 | (code >> 12));
+                strings += (char)(0x80 | ((code >> 6) & 0x3F));
+                strings += (char)(0x80 | (code & 0x3F));
+            } else {
+                strings += (char)(0xF0 | (code >> 18));
+                strings += (char)(0x80 | ((code >> 12) & 0x3F));
+                strings += (char)(0x80 | ((code >> 6) & 0x3F));
+                strings += (char)(0x80 | (code & 0x3F));
+            }
+        }
+
+        void String() {
+            pos_++;
+            Token token{Token::String};
+            token.offset = strings.size();
+
+            while(true) {
+                // Copy the run up to the next quote or escape at once
+                size_t end = pos_;
+                while(end < json_.size() && json_[end] != '"' && json_[end] != '\\')
+                    end++;
+                strings.append(json_.data() + pos_, end - pos_);
+                pos_ = end;
+
+                if(pos_ == json_.size())
+                    Fail("unterminated string");
+                if(json_[pos_++] == '"')
+                    break;
+
+                if(pos_ == json_.size())
+                    Fail("unterminated string");
+                char c = json_[pos_++];
+                switch(c) {
+                case '"': strings += '"'; break;
+                case '\\': strings += '\\'; break;
+                case '/': strings += '/'; break;
+                case 'b': strings += '\b'; break;
+                case 'f': strings += '\f'; break;
+                case 'n': strings += '\n'; break;
+                case 'r': strings += '\r'; break;
+                case 't': strings += '\t'; break;
+                case 'u': {
+                    uint32_t code = Hex4();
+                    if(code >= 0xD800 && code < 0xDC00 && json_.substr(pos_, 2) == "\\u") {
+                        size_t pos = pos_;
+                        pos_ += 2;
+                        uint32_t low = Hex4();
+                        if(low >= 0xDC00 && low < 0xE000)
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        else
+                            pos_ = pos; // Lone high surrogate, the next escape is its own character
+                    }
+                    AppendUTF8(code);
+                    break;
+                }
+                default:
+                    Fail("invalid escape");
+                }
+            }
+
+            token.length = strings.size() - token.offset;
+            tokens.push_back(token);
+        }
+
+        void Number() {
+            size_t start = pos_;
+            bool negative = pos_ < json_.size() && json_[pos_] == '-';
+            if(negative)
+                pos_++;
+
+            // std::to_string writes these for doubles that aren't finite
+            if(Consume("nan")) {
+                Token token{Token::Float};
+                token.f = std::nan("");
+                tokens.push_back(token);
+                return;
+            }
+            if(Consume("inf")) {
+                Token token{Token::Float};
+                token.f = negative ? -INFINITY : INFINITY;
+                tokens.push_back(token);
+                return;
+            }
+
+            bool integral = true;
+            while(pos_ < json_.size()) {
+                char c = json_[pos_];
+                if(c >= '0' && c <= '9') {
+                } else if(c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+                    integral = false;
+                } else {
+                    break;
+                }
+                pos_++;
+            }
+            if(pos_ == start + negative)
+                Fail("unexpected character");
+
+            std::string text(json_.substr(start, pos_ - start));
+            char* end;
+            Token token{Token::Float};
+            errno = 0;
+            if(integral && negative) {
+                token.type = Token::Int;
+                token.i = std::strtoll(text.c_str(), &end, 10);
+            } else if(integral) {
+                token.type = Token::UInt;
+                token.u = std::strtoull(text.c_str(), &end, 10);
+            }
+            // Integers too large for 64 bits are kept as doubles
+            if(!integral || errno == ERANGE) {
+                token.type = Token::Float;
+                token.f = std::strtod(text.c_str(), &end);
+            }
+            if(end != text.c_str() + text.size())
+                Fail("invalid number");
+            tokens.push_back(token);
+        }
+
+        std::string_view json_;
+        size_t pos_ = 0;
+    };
+
+} // anonymous
+
+void AppendMessagePack(std::string_view json, std::string& out) {
+    Parser parser(json);
+    parser.Parse();
+
+    MessagePackEncoder encoder(out);
+    for(const Token& token : parser.tokens) {
+        switch(token.type) {
+        case Token::Nil: encoder.Nil(); break;
+        case Token::False: encoder.Bool(false); break;
+        case Token::True: encoder.Bool(true); break;
+        case Token::Int: encoder.Int(token.i); break;
+        case Token::UInt: encoder.UInt(token.u); break;
+        case Token::Float: encoder.Float(token.f); break;
+        case Token::String: encoder.String(std::string_view(parser.strings).substr(token.offset, token.length)); break;
+        case Token::Array: encoder.Array(token.count); break;
+        case Token::Map: encoder.Map(token.count); break;
+        }
+    }
+}
+
+} // gcheck
@@ -1,41 +1,312 @@
 #include "multiprocessing.h"
 
+#include <string>
+#include <stdexcept>
+#include <cstring>
+#if defined(__linux__)
+    #include <poll.h>
+    #include <sys/syscall.h>
+    #include <sys/resource.h>
+#endif
+
 namespace gcheck {
 
+ResourceUsage ResourceUsage::operator-(const ResourceUsage& earlier) const {
+    ResourceUsage usage = *this;
+    usage.user_time -= earlier.user_time;
+    usage.system_time -= earlier.system_time;
+    usage.minor_faults -= earlier.minor_faults;
+    usage.major_faults -= earlier.major_faults;
+    usage.voluntary_switches -= earlier.voluntary_switches;
+    usage.involuntary_switches -= earlier.involuntary_switches;
+    return usage;
+}
+
 #if defined(__linux__)
-ForkStatus wait_timeout(pid_t pid, std::chrono::duration<double> time) {
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGCHLD);
+namespace {
+    std::chrono::duration<double> to_duration(const timeval& t) {
+        return std::chrono::seconds(t.tv_sec) + std::chrono::microseconds(t.tv_usec);
+    }
 
-    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
-        return ERROR;
+    ResourceUsage to_usage(const rusage& r) {
+        ResourceUsage usage;
+        usage.user_time = to_duration(r.ru_utime);
+        usage.system_time = to_duration(r.ru_stime);
+        usage.max_rss = r.ru_maxrss;
+        usage.minor_faults = r.ru_minflt;
+        usage.major_faults = r.ru_majflt;
+        usage.voluntary_switches = r.ru_nvcsw;
+        usage.involuntary_switches = r.ru_nivcsw;
+        return usage;
+    }
+
+    // Sets the soft limit of resource. The soft limit can't be raised over the hard limit.
+    void set_limit(int resource, rlim_t value, const char* name) {
+        rlimit limit;
+        if(getrlimit(resource, &limit) != 0)
+            throw std::runtime_error(std::string("Unable to get the ") + name + " limit: " + strerror(errno));
+
+        limit.rlim_cur = limit.rlim_max == RLIM_INFINITY ? value : std::min(value, limit.rlim_max);
+        if(setrlimit(resource, &limit) != 0)
+            throw std::runtime_error(std::string("Unable to set the ") + name + " limit: " + strerror(errno));
+    }
+
+    int pidfd_open(pid_t pid) {
+#if defined(SYS_pidfd_open)
+        return syscall(SYS_pidfd_open, pid, 0);
+#else
+        (void)pid;
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    // Interval for polling the children that have no pidfd
+    const auto fallback_poll_interval = std::chrono::milliseconds(10);
+}
+
+void ResourceLimits::Apply() const {
+    if(cpu_time) {
+        // RLIMIT_CPU counts all of the CPU time of the process and has a resolution of a second.
+        // The limit is rounded to the nearest second but kept above the time already used.
+        auto usage = ResourceUsage::Self();
+        auto used = usage.user_time + usage.system_time;
+        auto total = std::max(std::chrono::round<std::chrono::seconds>(used + std::chrono::duration<double>(*cpu_time)),
+                std::chrono::floor<std::chrono::seconds>(used) + std::chrono::seconds(1));
+        set_limit(RLIMIT_CPU, total.count(), "CPU time");
+    }
+    if(memory)
+        set_limit(RLIMIT_DATA, *memory, "memory");
+    if(file_size)
+        set_limit(RLIMIT_FSIZE, *file_size, "file size");
+    if(processes)
+        set_limit(RLIMIT_NPROC, *processes, "process count");
+}
+
+ResourceUsage ResourceUsage::Self() {
+    rusage r;
+    getrusage(RUSAGE_SELF, &r);
+    return to_usage(r);
+}
+
+ChildSupervisor::~ChildSupervisor() {
+    for(auto& [pid, child] : children_) {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        if(child.fd >= 0)
+            close(child.fd);
     }
+}
+
+void ChildSupervisor::Add(pid_t pid, std::chrono::duration<double> timeout) {
+    Child child{pidfd_open(pid), std::nullopt};
+    if(timeout != timeout.zero())
+        child.deadline = std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+    children_.emplace(pid, child);
+}
+
+ChildSupervisor::Exit ChildSupervisor::Reap(pid_t pid, bool timed_out) {
+    auto it = children_.find(pid);
+    if(timed_out)
+        kill(pid, SIGKILL);
 
-    auto secs = std::chrono::floor<std::chrono::seconds>(time);
-    auto nsecs = std::chrono::ceil<std::chrono::nanoseconds>(time-secs);
+    int status = 0;
+    rusage usage{};
+    while(wait4(pid, &status, 0, &usage) < 0 && errno == EINTR);
+    if(it->second.fd >= 0)
+        close(it->second.fd);
+    children_.erase(it);
 
-    struct timespec timeout;
-    timeout.tv_sec = secs.count();
-    timeout.tv_nsec = nsecs.count();
+    if(timed_out)
+        return {pid, TIMEDOUT, status, to_usage(usage)};
+    return {pid, WIFEXITED(status) && WEXITSTATUS(status) == 0 ? OK : ERROR, status, to_usage(usage)};
+}
 
-    siginfo_t info;
+ChildSupervisor::Exit ChildSupervisor::Wait() {
+    if(children_.empty())
+        throw std::logic_error("ChildSupervisor::Wait called without children");
+
+    std::vector<pollfd> fds;
+    std::vector<pid_t> pids;
     while(true) {
-        int val = sigtimedwait(&mask, &info, &timeout);
-        if(val >= 0) {
-            if(info.si_pid != pid) continue;
-            else break;
-        } else if (errno == EINTR) {
-            continue;
-        } else if (errno == EAGAIN) {
-            kill(pid, SIGKILL);
-            return TIMEDOUT;
+        auto now = std::chrono::steady_clock::now();
+        std::optional<std::chrono::steady_clock::time_point> next_deadline;
+        bool polling = false;
+        fds.clear();
+        pids.clear();
+        for(auto& [pid, child] : children_) {
+            if(child.deadline && *child.deadline <= now)
+                return Reap(pid, true);
+
+            if(child.fd < 0) {
+                int status;
+                rusage usage{};
+                if(wait4(pid, &status, WNOHANG, &usage) == pid) {
+                    children_.erase(pid);
+                    return {pid, WIFEXITED(status) && WEXITSTATUS(status) == 0 ? OK : ERROR, status, to_usage(usage)};
+                }
+                polling = true;
+            } else {
+                fds.push_back({child.fd, POLLIN, 0});
+                pids.push_back(pid);
+            }
+
+            if(child.deadline && (!next_deadline || *child.deadline < *next_deadline))
+                next_deadline = child.deadline;
+        }
+
+        int timeout_ms = -1;
+        if(next_deadline)
+            timeout_ms = std::chrono::ceil<std::chrono::milliseconds>(*next_deadline - now).count();
+        if(polling && (timeout_ms < 0 || timeout_ms > fallback_poll_interval.count()))
+            timeout_ms = fallback_poll_interval.count();
+
+        int ret = poll(fds.data(), fds.size(), timeout_ms);
+        if(ret < 0 && errno != EINTR)
+            throw std::runtime_error("Waiting for children failed: " + std::string(strerror(errno)));
+
+        for(size_t i = 0; ret > 0 && i < fds.size(); i++) {
+            if(fds[i].revents != 0)
+                return Reap(pids[i], false);
         }
-        break;
     }
+}
+
+std::string DescribeExit(int wait_status) {
+    if(WIFSIGNALED(wait_status))
+        return "killed by signal " + std::to_string(WTERMSIG(wait_status)) + " (" + strsignal(WTERMSIG(wait_status)) + ")";
+    if(WIFEXITED(wait_status))
+        return "exited with status " + std::to_string(WEXITSTATUS(wait_status));
+    return "stopped with status " + std::to_string(wait_status);
+}
 
-    return info.si_status == 0 ? OK : ERROR;
+ForkStatus wait_timeout(pid_t pid, std::chrono::duration<double> time) {
+    ChildSupervisor supervisor;
+    supervisor.Add(pid, time);
+    return supervisor.Wait().status;
+}
+
+int wait_usage(pid_t pid, ResourceUsage& usage_out) {
+    int status = 0;
+    rusage usage{};
+    while(wait4(pid, &status, 0, &usage) < 0 && errno == EINTR);
+    usage_out = to_usage(usage);
+    return status;
+}
+
+bool wait_readable(int fd, std::chrono::duration<double> timeout) {
+    int timeout_ms = -1;
+    if(timeout != timeout.zero())
+        timeout_ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+
+    pollfd pfd{fd, POLLIN, 0};
+    int ret;
+    while((ret = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR);
+
+    return ret != 0;
+}
+
+ForkServer::ForkServer(std::function<void(size_t, shared_manager&)> handler) : memory_(shared_manager::limit_), handler_(handler) {}
+
+ForkServer::~ForkServer() {
+    Stop();
+}
+
+void ForkServer::Start() {
+    if(IsRunning())
+        return;
+
+    int requests[2], responses[2];
+    if(pipe(requests) != 0)
+        throw std::runtime_error("Unable to create a pipe for the fork server: " + std::string(strerror(errno)));
+    if(pipe(responses) != 0) {
+        close(requests[0]);
+        close(requests[1]);
+        throw std::runtime_error("Unable to create a pipe for the fork server: " + std::string(strerror(errno)));
+    }
+
+    // Buffered output would otherwise be written by the worker too
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_ = fork();
+    if(pid_ == 0) {
+        close(requests[1]);
+        close(responses[0]);
+
+        size_t request;
+        while(read(requests[0], &request, sizeof(request)) == sizeof(request)) {
+            handler_(request, memory_);
+
+            ResourceUsage usage = ResourceUsage::Self();
+            if(write(responses[1], &usage, sizeof(usage)) != sizeof(usage))
+                break;
+        }
+        exit(0);
+    }
+
+    close(requests[0]);
+    close(responses[1]);
+    if(pid_ < 0) {
+        close(requests[1]);
+        close(responses[0]);
+        throw std::runtime_error("Unable to fork the fork server: " + std::string(strerror(errno)));
+    }
+    request_fd_ = requests[1];
+    response_fd_ = responses[0];
+    reported_ = ResourceUsage();
+}
+
+void ForkServer::Stop() {
+    if(IsRunning())
+        Reap();
+}
+
+ResourceUsage ForkServer::Reap() {
+    // The worker exits when it sees the end of the request pipe
+    close(request_fd_);
+    close(response_fd_);
+    ResourceUsage usage;
+    wait_usage(pid_, usage);
+    pid_ = -1;
+    return usage;
+}
+
+ResourceUsage ForkServer::Kill() {
+    kill(pid_, SIGKILL);
+    return Reap();
+}
+
+ForkStatus ForkServer::Run(size_t request, std::chrono::duration<double> timeout, ResourceUsage& usage_out) {
+    Start();
+
+    if(write(request_fd_, &request, sizeof(request)) != sizeof(request)) {
+        usage_out = Kill() - reported_;
+        return ERROR;
+    }
+
+    if(!wait_readable(response_fd_, timeout)) {
+        usage_out = Kill() - reported_;
+        return TIMEDOUT;
+    }
+
+    ResourceUsage usage;
+    if(read(response_fd_, &usage, sizeof(usage)) != sizeof(usage)) {
+        // The worker crashed
+        usage_out = Kill() - reported_;
+        return ERROR;
+    }
+
+    usage_out = usage - reported_;
+    reported_ = usage;
+    return OK;
+}
+#else
+void ResourceLimits::Apply() const {
+}
+ResourceUsage ResourceUsage::Self() {
+    return ResourceUsage();
 }
 #endif
 
-} // gcheck
\ No newline at end of file
+} // gcheck
@@ -0,0 +1,166 @@
+#include "perf_counters.h"
+
+#include <cstring>
+#include <ctime>
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace gcheck {
+
+bool PerfCounters::IsWithin(const PerfCounters& limits) const {
+    auto within = [](const auto& value, const auto& limit) {
+        return !value || !limit || *value <= *limit;
+    };
+    return within(instructions, limits.instructions)
+        && within(cycles, limits.cycles)
+        && within(cache_misses, limits.cache_misses)
+        && within(branch_misses, limits.branch_misses)
+        && within(task_clock, limits.task_clock);
+}
+
+namespace {
+    std::chrono::nanoseconds thread_time() {
+#if defined(__linux__)
+        timespec t;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+        return std::chrono::seconds(t.tv_sec) + std::chrono::nanoseconds(t.tv_nsec);
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>((double)std::clock()/CLOCKS_PER_SEC));
+#endif
+    }
+
+#if defined(__linux__)
+    int open_counter(uint32_t type, uint64_t config, int group) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        if(group == -1 && type == PERF_TYPE_HARDWARE)
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+    }
+#endif
+} // anonymous
+
+PerfCounterGroup::~PerfCounterGroup() {
+    Close();
+}
+
+#if defined(__linux__)
+void PerfCounterGroup::Open() {
+    Close();
+    pid_ = getpid();
+
+    const std::pair<Counter, uint64_t> hardware[] = {
+        {Instructions, PERF_COUNT_HW_INSTRUCTIONS},
+        {Cycles, PERF_COUNT_HW_CPU_CYCLES},
+        {CacheMisses, PERF_COUNT_HW_CACHE_MISSES},
+        {BranchMisses, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+    for(auto [counter, config] : hardware) {
+        int fd = open_counter(PERF_TYPE_HARDWARE, config, leader_);
+        if(fd == -1)
+            continue;
+        if(leader_ == -1)
+            leader_ = fd;
+        counters_.emplace_back(counter, fd);
+    }
+
+    task_clock_ = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1);
+}
+
+void PerfCounterGroup::Close() {
+    // Siblings first, the leader is the first one
+    for(auto it = counters_.rbegin(); it != counters_.rend(); ++it)
+        close(it->second);
+    counters_.clear();
+    leader_ = -1;
+    if(task_clock_ != -1)
+        close(task_clock_);
+    task_clock_ = -1;
+}
+
+void PerfCounterGroup::Start() {
+    if(pid_ != getpid())
+        Open();
+
+    if(leader_ != -1) {
+        ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    if(task_clock_ != -1) {
+        ioctl(task_clock_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(task_clock_, PERF_EVENT_IOC_ENABLE, 0);
+    } else {
+        thread_time_ = thread_time();
+    }
+}
+
+PerfCounters PerfCounterGroup::Stop() {
+    PerfCounters counters;
+
+    if(task_clock_ != -1) {
+        ioctl(task_clock_, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t value;
+        if(read(task_clock_, &value, sizeof(value)) == sizeof(value))
+            counters.task_clock = std::chrono::nanoseconds(value);
+    } else {
+        counters.task_clock = thread_time() - thread_time_;
+    }
+
+    if(leader_ != -1) {
+        ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        // nr, time_enabled, time_running and a value for each counter of the group
+        uint64_t values[3 + NumCounters];
+        ssize_t size = (3 + counters_.size())*sizeof(uint64_t);
+        // The group didn't fit on the PMU at all if it wasn't running
+        if(read(leader_, values, size) == size && values[0] == counters_.size() && values[2] != 0) {
+            // Scale the counts up if the counters were multiplexed with other events
+            double scale = (double)values[1]/values[2];
+            for(size_t i = 0; i < counters_.size(); i++) {
+                uint64_t value = (uint64_t)(values[3 + i]*scale);
+                switch(counters_[i].first) {
+                case Instructions:
+                    counters.instructions = value;
+                    break;
+                case Cycles:
+                    counters.cycles = value;
+                    break;
+                case CacheMisses:
+                    counters.cache_misses = value;
+                    break;
+                case BranchMisses:
+                    counters.branch_misses = value;
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+    }
+
+    return counters;
+}
+#else
+void PerfCounterGroup::Open() {}
+void PerfCounterGroup::Close() {}
+void PerfCounterGroup::Start() {
+    thread_time_ = thread_time();
+}
+PerfCounters PerfCounterGroup::Stop() {
+    PerfCounters counters;
+    counters.task_clock = thread_time() - thread_time_;
+    return counters;
+}
+#endif
+
+} // gcheck
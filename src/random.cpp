@@ -0,0 +1,54 @@
+#include "random.h"
+
+#include <random>
+
+namespace gcheck {
+
+namespace {
+    bool seeded = false;
+    uint64_t seed = 0;
+
+    // Key of the test and run being prepared, without the seed
+    uint64_t run_key = 0;
+    // Streams created in the current run
+    uint64_t streams_created = 0;
+
+    // FNV-1a, the names must hash the same on every platform
+    uint64_t hash_name(const std::string& name) {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for(unsigned char c : name) {
+            hash ^= c;
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+} // anonymous
+
+uint64_t RandomStream::generation_now_ = 1;
+
+uint64_t GetRandomSeed() {
+    if(!seeded)
+        SetRandomSeed(std::random_device()());
+    return seed;
+}
+
+void SetRandomSeed(uint64_t value) {
+    seed = value;
+    seeded = true;
+    RandomStream::generation_now_++;
+}
+
+void SetRandomRun(const std::string& suite, const std::string& test, size_t run_index) {
+    run_key = MixKey(hash_name(suite + "." + test), run_index);
+    streams_created = 0;
+    RandomStream::generation_now_++;
+}
+
+RandomStream::RandomStream() : origin_(MixKey(run_key, streams_created++)), generation_(0) {}
+
+void RandomStream::Rekey() {
+    engine_ = RandomEngine(MixKey(MixKey(GetRandomSeed(), run_key), origin_));
+    generation_ = generation_now_;
+}
+
+} // gcheck
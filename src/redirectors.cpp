@@ -1,6 +1,11 @@
 #include "redirectors.h"
 #include <stdio.h>
 #include <cerrno>
+#include <cstring>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
 #if defined(WIN32) || defined(_WIN32)
     #include <fcntl.h>
     #include <io.h>
@@ -8,15 +13,103 @@
     #define dup2(fd, fd2) _dup2(fd, fd2)
     #define fileno(file) _fileno(file)
     #define pipe(p) _pipe(p, 1024, _O_TEXT)
+    #define lseek(fd, offset, origin) _lseek(fd, offset, origin)
+    #define read(fd, buffer, count) _read(fd, buffer, count)
+    #define write(fd, buffer, count) _write(fd, buffer, count)
 #else
+    #include <fcntl.h>
+    #include <poll.h>
     #include <unistd.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
 #endif
-#include <string>
-#include <sstream>
-#include <iostream>
 
 namespace gcheck {
 
+namespace {
+    // Size of the file, or -1 on failure
+    long file_size(int fd) {
+#if defined(WIN32) || defined(_WIN32)
+        long pos = lseek(fd, 0, SEEK_CUR);
+        long size = lseek(fd, 0, SEEK_END);
+        lseek(fd, pos, SEEK_SET);
+        return size;
+#else
+        struct stat st;
+        if(fstat(fd, &st) == -1)
+            return -1;
+        return (long)st.st_size;
+#endif
+    }
+
+    // Reads 'count' bytes starting at 'offset'. Returns the number of bytes read.
+    size_t read_at(int fd, char* buffer, size_t count, long offset) {
+        size_t total = 0;
+#if defined(WIN32) || defined(_WIN32)
+        long pos = lseek(fd, 0, SEEK_CUR);
+        lseek(fd, offset, SEEK_SET);
+        while(total < count) {
+            int n = read(fd, buffer + total, (unsigned int)std::min<size_t>(count - total, 1 << 30));
+            if(n <= 0)
+                break;
+            total += n;
+        }
+        lseek(fd, pos, SEEK_SET);
+#else
+        while(total < count) {
+            ssize_t n = pread(fd, buffer + total, count - total, offset + total);
+            if(n == -1 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                break;
+            total += n;
+        }
+#endif
+        return total;
+    }
+
+    // Writes everything, waiting for non-blocking files to become writable
+    void write_all(int fd, const char* buffer, size_t count) {
+        while(count > 0) {
+            auto n = write(fd, buffer, (unsigned int)std::min<size_t>(count, 1 << 30));
+            if(n == -1 && errno == EINTR)
+                continue;
+#if !defined(WIN32) && !defined(_WIN32)
+            if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                pollfd p = {fd, POLLOUT, 0};
+                poll(&p, 1, -1);
+                continue;
+            }
+#endif
+            if(n <= 0)
+                return;
+            buffer += n;
+            count -= n;
+        }
+    }
+
+    // Writes what can be written to a non-blocking file without waiting. Returns the number of bytes written.
+    size_t write_some(int fd, const char* buffer, size_t count) {
+        size_t total = 0;
+#if !defined(WIN32) && !defined(_WIN32)
+        while(total < count) {
+            ssize_t n = write(fd, buffer + total, count - total);
+            if(n == -1 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                break;
+            total += n;
+        }
+#else
+        // Pipes can't be non-blocking here, so everything is left for the writer thread
+        (void)fd;
+        (void)buffer;
+        (void)count;
+#endif
+        return total;
+    }
+} // anonymous
+
 FileInjecter::FileInjecter(FILE* stream, std::string str, std::istream* associate)
         : FileInjecter(stream, true, associate) {
     if(str.length() != 0) {
@@ -25,7 +118,7 @@ FileInjecter::FileInjecter(FILE* stream, std::string str, std::istream* associat
 }
 
 FileInjecter::FileInjecter(FILE* stream, bool capture, std::istream* associate)
-        : swapped_(false), closed_(true), associate_(associate) {
+        : swapped_(false), closed_(true), from_file_(false), out_(-1), in_(-1), associate_(associate) {
     original_ = stream;
     save_ = dup(fileno(stream));
 
@@ -41,8 +134,23 @@ FileInjecter::~FileInjecter() {
 FileInjecter& FileInjecter::Write(std::string str) {
     if(!swapped_ || closed_) Capture();
 
-    fputs(str.c_str(), out_);
-    fflush(out_);
+    if(!writer_.joinable()) {
+#if defined(F_SETPIPE_SZ)
+        // A larger pipe lets more of the input be written right away
+        if(str.size() > (1 << 16))
+            fcntl(out_, F_SETPIPE_SZ, (int)std::min<size_t>(str.size(), 1 << 20));
+#endif
+        str.erase(0, write_some(out_, str.data(), str.size()));
+        if(str.empty())
+            return *this;
+    }
+
+    // The rest is written while the input is read, after what was written before
+    writer_ = std::thread([previous = std::move(writer_), fd = out_, str = std::move(str)]() mutable {
+        if(previous.joinable())
+            previous.join();
+        write_all(fd, str.data(), str.size());
+    });
 
     return *this;
 }
@@ -61,12 +169,44 @@ FileInjecter& FileInjecter::Capture() {
 
     int fds[2];
     pipe(fds);
-    out_ = fdopen(fds[1], "w");
+#if !defined(WIN32) && !defined(_WIN32)
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+#endif
+    out_ = fds[1];
+    // Kept open so that the writers don't get SIGPIPE if the tested function closes the stream
+    in_ = fds[0];
     dup2(fds[0], fileno(original_));
-    close(fds[0]);
 
     swapped_ = true;
     closed_ = false;
+    from_file_ = false;
+
+    return *this;
+}
+
+FileInjecter& FileInjecter::Open(const std::string& path) {
+    if(swapped_)
+        Restore();
+    else if(!closed_)
+        Close();
+
+#if defined(WIN32) || defined(_WIN32)
+    int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    if(fd == -1)
+        throw std::runtime_error("Unable to open input file " + path + ": " + std::strerror(errno));
+
+    if(associate_ != nullptr)
+        original_state_ = associate_->rdstate();
+
+    dup2(fd, fileno(original_));
+    close(fd);
+
+    swapped_ = true;
+    closed_ = true;
+    from_file_ = true;
 
     return *this;
 }
@@ -76,7 +216,18 @@ FileInjecter& FileInjecter::Restore() {
     if(!swapped_) return *this;
 
     char buffer[1024];
-    while(fgets(buffer, 1024, original_) != NULL);
+    if(from_file_) {
+        // Discards what's left in the buffer of the stream
+        fseek(original_, 0, SEEK_END);
+    } else {
+        while(fgets(buffer, 1024, original_) != NULL);
+        // The stream may have been closed, so the rest is drained directly to let the writers finish
+        while(read(in_, buffer, sizeof(buffer)) > 0);
+        if(writer_.joinable())
+            writer_.join();
+        close(in_);
+        in_ = -1;
+    }
     clearerr(original_);
 
     dup2(save_, fileno(original_));
@@ -90,38 +241,53 @@ FileInjecter& FileInjecter::Restore() {
 
 FileInjecter& FileInjecter::Close() {
     if(closed_) return *this;
-
-    fclose(out_);
     closed_ = true;
 
+    if(writer_.joinable()) {
+        // Closed once the writers are done
+        writer_ = std::thread([previous = std::move(writer_), fd = out_]() mutable {
+            previous.join();
+            close(fd);
+        });
+    } else {
+        close(out_);
+    }
+    out_ = -1;
+
     return *this;
 }
 
-
-
-FileCapturer::FileCapturer(FILE* stream, bool capture) : is_swapped_(false), last_pos_(0), fileno_(fileno(stream)), original_(stream) {
-    new_ = tmpfile();
-    if(new_ == NULL) {
-        int err = errno;
-        std::string desc = "errno: " + std::to_string(err) + ", " + std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": ";
-        switch(err) {
-            case EACCES:
-                throw std::runtime_error(desc + "No file permissions");
-            case EEXIST:
-                throw std::runtime_error(desc + "Unable to generate a unique filename");
-            case EINTR:
-                throw std::runtime_error(desc + "The call was interrupted by a signal");
-            case EMFILE:
-                throw std::runtime_error(desc + "Too many open files in process");
-            case ENFILE:
-                throw std::runtime_error(desc + "Too many files open in system");
-            case ENOSPC:
-                throw std::runtime_error(desc + "Directory full");
-            case EROFS:
-                throw std::runtime_error(desc + "File system is read-only");
-            default:
-                throw;
+FileCapturer::FileCapturer(FILE* stream, bool capture)
+        : is_swapped_(false), last_pos_(0), fileno_(fileno(stream)), fd_(-1), new_(NULL), original_(stream), mapping_(nullptr), mapped_size_(0),
+          stream_(false), limit_(0), context_(0), pipe_(-1) {
+#if defined(__linux__)
+    fd_ = memfd_create("gcheck_capture", MFD_CLOEXEC);
+#endif
+    if(fd_ == -1) {
+        new_ = tmpfile();
+        if(new_ == NULL) {
+            int err = errno;
+            std::string desc = "errno: " + std::to_string(err) + ", " + std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": ";
+            switch(err) {
+                case EACCES:
+                    throw std::runtime_error(desc + "No file permissions");
+                case EEXIST:
+                    throw std::runtime_error(desc + "Unable to generate a unique filename");
+                case EINTR:
+                    throw std::runtime_error(desc + "The call was interrupted by a signal");
+                case EMFILE:
+                    throw std::runtime_error(desc + "Too many open files in process");
+                case ENFILE:
+                    throw std::runtime_error(desc + "Too many files open in system");
+                case ENOSPC:
+                    throw std::runtime_error(desc + "Directory full");
+                case EROFS:
+                    throw std::runtime_error(desc + "File system is read-only");
+                default:
+                    throw;
+            }
         }
+        fd_ = fileno(new_);
     }
 
     if(capture)
@@ -130,30 +296,57 @@ FileCapturer::FileCapturer(FILE* stream, bool capture) : is_swapped_(false), las
 
 FileCapturer::~FileCapturer() {
     Restore();
-    if(new_ == NULL) return;
+    if(fd_ == -1) return;
 
-    fclose(new_);
-    close(save_);
+    Unmap();
+    if(new_ != NULL)
+        fclose(new_);
+    else
+        close(fd_);
     new_ = NULL;
+    fd_ = -1;
+}
+
+void FileCapturer::Unmap() {
+#if !defined(WIN32) && !defined(_WIN32)
+    if(mapping_ != nullptr)
+        munmap(mapping_, mapped_size_);
+#endif
+    mapping_ = nullptr;
+    mapped_size_ = 0;
 }
 
-std::string FileCapturer::str() {
-    if(new_ == NULL) return "";
+std::string_view FileCapturer::view() {
+    if(fd_ == -1) return "";
 
-    fflush(new_);
+    if(is_swapped_)
+        fflush(original_);
 
-    fseek(new_, last_pos_, SEEK_SET);
+    long size = file_size(fd_);
+    if(size <= last_pos_) return "";
 
-    std::stringstream ss;
+    long begin = last_pos_;
+    last_pos_ = size;
 
-    int c = EOF+1;
-    while((c = fgetc(new_)) != EOF) {
-        ss.put(c);
+#if !defined(WIN32) && !defined(_WIN32)
+    if((size_t)size > mapped_size_) {
+        // Map more than needed so that output growing a bit at a time doesn't remap on every call.
+        // Mapping past the end of the file is fine as long as only the part within the file is accessed.
+        size_t new_size = std::max((size_t)size, mapped_size_*2);
+        Unmap();
+        void* mapping = mmap(nullptr, new_size, PROT_READ, MAP_SHARED, fd_, 0);
+        if(mapping != MAP_FAILED) {
+            mapping_ = (char*)mapping;
+            mapped_size_ = new_size;
+        }
     }
+    if(mapping_ != nullptr)
+        return std::string_view(mapping_ + begin, size - begin);
+#endif
 
-    last_pos_ = ftell(new_);
-
-    return ss.str();
+    buffer_.resize(size - begin);
+    buffer_.resize(read_at(fd_, buffer_.data(), buffer_.size(), begin));
+    return buffer_;
 }
 
 FileCapturer& FileCapturer::Restore() {
@@ -164,24 +357,108 @@ FileCapturer& FileCapturer::Restore() {
     dup2(save_, fileno_);
     close(save_);
 
+    // The pipe is closed now that fileno_ doesn't refer to it, so the pump reads until the end and returns
+    if(pump_.joinable()) {
+        pump_.join();
+        close(pipe_);
+        pipe_ = -1;
+    }
+
     return *this;
 }
 
 FileCapturer& FileCapturer::Capture() {
-    if(new_ == NULL) throw; // TODO: better exception
+    if(fd_ == -1) throw; // TODO: better exception
     if(is_swapped_) return *this;
     is_swapped_ = true;
 
     fflush(original_);
+
+    long size = file_size(fd_);
+#if !defined(WIN32) && !defined(_WIN32)
+    if(size == last_pos_ && size > 0 && ftruncate(fd_, 0) == 0) {
+        // Everything has been read already, so start over instead of growing the file indefinitely
+        size = 0;
+    }
+#endif
+    lseek(fd_, size, SEEK_SET);
+    last_pos_ = size;
+
     save_ = dup(fileno_);
-    dup2(fileno(new_), fileno_);
 
-    fseek(new_, 0, SEEK_END);
-    last_pos_ = ftell(new_);
+    comparison_ = OutputComparison();
+    int fds[2];
+    if(stream_ && pipe(fds) == 0) {
+        dup2(fds[1], fileno_);
+        close(fds[1]);
+        pipe_ = fds[0];
+        // Started here so that the tested function doesn't see the allocations of starting a thread
+        pump_ = std::thread([this]() { Pump(); });
+    } else {
+        dup2(fd_, fileno_);
+    }
+
+    return *this;
+}
+
+FileCapturer& FileCapturer::Stream(std::optional<std::string_view> expected, size_t limit, size_t context) {
+    stream_ = true;
+    expected_ = expected;
+    limit_ = expected ? std::max(limit, expected->size()) : limit;
+    context_ = context;
+    return *this;
+}
 
+FileCapturer& FileCapturer::StopStreaming() {
+    stream_ = false;
+    expected_.reset();
     return *this;
 }
 
+void FileCapturer::Pump() {
+    // On the stack so that the tested function's allocations aren't mixed with the pump's
+    char buffer[1 << 16];
+    while(true) {
+        auto n = read(pipe_, buffer, sizeof(buffer));
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+
+        size_t begin = comparison_.size;
+        size_t end = begin + n;
+        comparison_.size = end;
+        comparison_.truncated = end > limit_;
+
+        // The part of the output to keep
+        size_t keep_begin = begin;
+        size_t keep_end = std::min(end, limit_);
+        if(expected_) {
+            if(!comparison_.mismatch) {
+                std::string_view expected = begin < expected_->size() ? expected_->substr(begin, n) : std::string_view();
+                size_t same = std::mismatch(expected.begin(), expected.end(), buffer).first - expected.begin();
+                if(same < (size_t)n)
+                    comparison_.mismatch = begin + same;
+            }
+            if(comparison_.mismatch) {
+                keep_begin = std::max(begin, *comparison_.mismatch);
+                keep_end = std::min(keep_end, *comparison_.mismatch + context_);
+            } else {
+                keep_end = keep_begin;
+            }
+        }
+
+        if(keep_begin < keep_end)
+            write_all(fd_, buffer + (keep_begin - begin), keep_end - keep_begin);
+    }
+
+    // Output that ended before the expected output did differs at its end
+    if(expected_ && !comparison_.mismatch && comparison_.size < expected_->size())
+        comparison_.mismatch = comparison_.size;
+    if(comparison_.mismatch)
+        comparison_.window = *comparison_.mismatch - std::min(*comparison_.mismatch, context_);
+}
+
 StdinInjecter::StdinInjecter(std::string str) : FileInjecter(stdin, str, &std::cin) {}
 StdinInjecter::StdinInjecter(const char* str) : StdinInjecter((std::string)str) {}
 StdinInjecter::StdinInjecter(bool capture) : FileInjecter(stdin, capture, &std::cin) {}
@@ -0,0 +1,112 @@
+#include "scheduler.h"
+
+#include <unordered_map>
+#include <algorithm>
+
+#include "gcheck.h"
+
+namespace gcheck {
+
+TestScheduler::TestScheduler(const std::vector<Test*>& tests, std::ostream& errors) : nodes_(tests.size()) {
+    std::unordered_map<const Test*, size_t> indices;
+    for(size_t i = 0; i < tests.size(); i++) {
+        nodes_[i].test = tests[i];
+        indices.emplace(tests[i], i);
+    }
+
+    for(size_t i = 0; i < nodes_.size(); i++) {
+        Node& node = nodes_[i];
+        for(auto& name : node.test->GetPrerequisite().GetNames()) {
+            Test* test = Test::FindTest(name.first, name.second);
+            auto it = test ? indices.find(test) : indices.end();
+            if(it == indices.end()) {
+                errors << "Prerequisite " << name.first << "." << name.second << " of test "
+                        << node.test->GetSuite() << "." << node.test->GetTest() << " doesn't exist" << std::endl;
+                node.missing++;
+                continue;
+            }
+            node.prerequisites.push_back(it->second);
+            nodes_[it->second].dependents.push_back(i);
+        }
+        node.waiting = node.prerequisites.size() + node.missing;
+    }
+
+    Order(errors);
+
+    for(size_t i = 0; i < nodes_.size(); i++)
+        if(nodes_[i].waiting == 0)
+            ready_.push(GetKey(i));
+}
+
+void TestScheduler::Order(std::ostream& errors) {
+    // Kahn's algorithm assuming every test passes. A test is run on the same pass as its prerequisites if it comes
+    // after them in the test list and on the next pass otherwise.
+    std::vector<size_t> remaining(nodes_.size());
+    std::vector<bool> ordered(nodes_.size(), false);
+    std::vector<size_t> stack;
+    for(size_t i = 0; i < nodes_.size(); i++) {
+        remaining[i] = nodes_[i].prerequisites.size();
+        if(remaining[i] == 0)
+            stack.push_back(i);
+    }
+
+    while(!stack.empty()) {
+        size_t index = stack.back();
+        stack.pop_back();
+        ordered[index] = true;
+
+        for(size_t dependent : nodes_[index].dependents) {
+            size_t pass = nodes_[index].pass + (index > dependent ? 1 : 0);
+            nodes_[dependent].pass = std::max(nodes_[dependent].pass, pass);
+            if(--remaining[dependent] == 0)
+                stack.push_back(dependent);
+        }
+    }
+
+    if(std::find(ordered.begin(), ordered.end(), false) != ordered.end())
+        ReportCycles(ordered, errors);
+}
+
+void TestScheduler::ReportCycles(const std::vector<bool>& ordered, std::ostream& errors) const {
+    // Every unordered test has an unordered prerequisite, so following them always leads to a cycle
+    std::vector<bool> visited(nodes_.size(), false);
+    for(size_t start = 0; start < nodes_.size(); start++) {
+        if(ordered[start] || visited[start])
+            continue;
+
+        std::vector<size_t> path;
+        size_t index = start;
+        while(!visited[index]) {
+            visited[index] = true;
+            path.push_back(index);
+            auto& prereqs = nodes_[index].prerequisites;
+            index = *std::find_if(prereqs.begin(), prereqs.end(), [&ordered](size_t i){ return !ordered[i]; });
+        }
+
+        auto cycle_start = std::find(path.begin(), path.end(), index);
+        if(cycle_start == path.end())
+            continue; // led to an already reported cycle
+
+        errors << "Prerequisite cycle (test -> prerequisite): ";
+        for(auto it = cycle_start; it != path.end(); it++)
+            errors << nodes_[*it].test->GetSuite() << "." << nodes_[*it].test->GetTest() << " -> ";
+        errors << nodes_[index].test->GetSuite() << "." << nodes_[index].test->GetTest() << std::endl;
+    }
+}
+
+size_t TestScheduler::Pop() {
+    size_t index = ready_.top().second;
+    ready_.pop();
+    return index;
+}
+
+void TestScheduler::Finish(size_t index, bool passed) {
+    if(!passed)
+        return;
+
+    for(size_t dependent : nodes_[index].dependents)
+        if(--nodes_[dependent].waiting == 0)
+            ready_.push(GetKey(dependent));
+}
+
+} // gcheck
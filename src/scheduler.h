@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <utility>
+#include <string>
+#include <iostream>
+
+namespace gcheck {
+
+class Test;
+
+/*
+    Dependency graph of the tests built from their prerequisites.
+    Tests become ready once all of their prerequisites have passed. Ready tests are given out in the order a
+    repeated scan over the test list would run them, so the order doesn't depend on how long the tests take.
+*/
+class TestScheduler {
+public:
+    // (scan pass, position in test list); the order in which tests are run and reported
+    typedef std::pair<size_t, size_t> Key;
+
+    /*
+        Builds the graph from 'tests'. Missing prerequisites and prerequisite cycles are written to 'errors'.
+        The tests depending on them are never ready.
+    */
+    TestScheduler(const std::vector<Test*>& tests, std::ostream& errors = std::cerr);
+
+    bool Empty() const { return ready_.empty(); }
+    // Key of the next ready test. Scheduler must not be empty.
+    const Key& NextKey() const { return ready_.top(); }
+    // Removes the next ready test from the queue and returns its position in the test list
+    size_t Pop();
+    // Marks the test as finished. If it passed, the tests waiting only for it become ready.
+    void Finish(size_t index, bool passed);
+
+    Test* GetTest(size_t index) const { return nodes_[index].test; }
+    Key GetKey(size_t index) const { return Key(nodes_[index].pass, index); }
+private:
+    struct Node {
+        Test* test;
+        std::vector<size_t> prerequisites;
+        std::vector<size_t> dependents;
+        size_t missing = 0; // number of prerequisites that don't exist
+        size_t waiting = 0; // number of prerequisites that haven't passed yet
+        size_t pass = 0;
+    };
+
+    void Order(std::ostream& errors);
+    void ReportCycles(const std::vector<bool>& ordered, std::ostream& errors) const;
+
+    std::vector<Node> nodes_;
+    std::priority_queue<Key, std::vector<Key>, std::greater<Key>> ready_;
+};
+
+} // gcheck
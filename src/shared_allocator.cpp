@@ -1,85 +1,40 @@
 #include "shared_allocator.h"
-#include <cstdint>
+#include <string>
+#include <stdexcept>
+#if defined(__linux__)
+    #include <sys/mman.h>
+    #include <errno.h>
+    #include <cstring>
+#endif
 
 namespace gcheck {
 
-shared_manager* shared_manager::manager = nullptr;
+size_t shared_manager::limit_ = 1024*1024*1024;
 
 #if defined(__linux__)
 shared_manager::shared_manager(size_t size) {
-    memory_ = (void**)mmap(NULL, sizeof(void*), PROT_READ | PROT_WRITE,
-            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-    *memory_ = nullptr;
+    if(size == 0)
+        return;
 
-    free_.emplace_back(nullptr, 0);
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(memory == MAP_FAILED)
+        throw std::runtime_error("Unable to reserve " + std::to_string(size) + " bytes of shared memory: " + strerror(errno));
 
-    if(size != 0)
-        Realloc(size);
+    memory_ = memory;
+    size_ = size;
 }
 
-void shared_manager::Realloc(size_t n) {
-    if(*memory_)
-        throw std::exception(); // not implemented
-    else {
-        *memory_ = mmap(NULL, n, PROT_READ | PROT_WRITE,
-                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-        free_.clear();
-        free_.emplace_back(*memory_, n);
-    }
-    size_ = n;
-}
-void shared_manager::FreeMemory() {
-    if(!memory_) return;
-
-    if(*memory_)
-        munmap(*memory_, size_);
-
-    size_ = 0;
-    *memory_ = nullptr;
-}
-void shared_manager::Free() {
-    if(memory_) {
-        FreeMemory();
-        munmap(memory_, sizeof(void*));
-    }
-    memory_ = nullptr;
+shared_manager::~shared_manager() {
+    if(memory_)
+        munmap(memory_, size_);
 }
 #else
 shared_manager::shared_manager(size_t) {
 }
-void shared_manager::Realloc(size_t) {
-}
-void shared_manager::FreeMemory() {
-}
-void shared_manager::Free() {
-}
-#endif
 
 shared_manager::~shared_manager() {
-    Free();
-    if(manager == this) {
-        manager = nullptr;
-    }
-}
-
-void* shared_manager::allocate(size_t n, const void *) {
-    auto it = std::find_if(free_.begin(), free_.end(), [n](auto& a){ return a.second >= n; });
-    if(it == free_.end()) {
-        return nullptr;
-    }
-    void* ptr = it->first;
-    if(n == it->second) {
-        free_.erase(it);
-    } else {
-        *it = std::pair<void*, size_t>((uint8_t*)it->first+n, it->second-n);
-    }
-    return ptr;
-}
-
-void shared_manager::deallocate(void* p, size_t n) {
-    if (!p) return;
-
-    free_.emplace_back(p, n);
 }
+#endif
 
-} // gcheck
\ No newline at end of file
+} // gcheck
@@ -1,97 +1,279 @@
 #include <string>
-#include <stack>
-#include <cstring>
 #include <sstream>
-#include <array>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
 
 #include "stringify.h"
 #include "user_object.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+    #define GCHECK_ESCAPE_SSE2
+    #include <emmintrin.h>
+#endif
+// The AVX2 version is compiled with a target attribute and chosen at run time
+#if defined(__GNUC__) && defined(__x86_64__)
+    #define GCHECK_ESCAPE_AVX2
+    #include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
 namespace gcheck {
 
-std::array<std::string, 256> replacee_array() {
-    static const char* digits = "0123456789ABCDEF";
+namespace {
+    inline unsigned lowest_bit(uint64_t mask) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return index;
+#else
+        return __builtin_ctzll(mask);
+#endif
+    }
+    inline unsigned highest_bit(uint64_t mask) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse64(&index, mask);
+        return index;
+#else
+        return 63 - __builtin_clzll(mask);
+#endif
+    }
+    inline unsigned bit_count(uint64_t mask) {
+#if defined(_MSC_VER)
+        return (unsigned)__popcnt64(mask);
+#else
+        return __builtin_popcountll(mask);
+#endif
+    }
 
-    std::array<std::string, 256> replacees;
+    const char hex_digits[] = "0123456789ABCDEF";
 
-    for (int i = 0; i < 256; ++i) {
-        replacees[i] = "\\u0000";
-        for (size_t j = 0; j < 2; ++j)
-            replacees[i][j+4] = digits[(i >> 4*(1-j)) & 0xf];
+    // Writes the six characters of the escape \u00XX of 'val'
+    inline void write_replacee(char* out, unsigned char val) {
+        out[0] = '\\';
+        out[1] = 'u';
+        out[2] = '0';
+        out[3] = '0';
+        out[4] = hex_digits[val >> 4];
+        out[5] = hex_digits[val & 0xF];
     }
 
-    return replacees;
-}
-std::string Replacee(unsigned char val) {
-    static const std::array<std::string, 256> replacees = replacee_array();
-    return replacees[val];
-}
+    // Whether the byte has to be looked at: control characters, quotes, backslashes and non-ASCII
+    inline bool is_special(unsigned char val) {
+        return val < 0x20 || val >= 0x80 || val == '\\' || val == '"';
+    }
 
-std::string JSONEscape(std::string str) {
-    // find non-utf-8 characters
-    for(size_t pos = 0; pos < str.length(); pos++) {
-        if((unsigned char)str[pos] == 0xC7) {
-            break;
+    /*
+        Writes the special byte at 'pos' to 'out' and returns the position after it. A valid UTF-8 sequence is copied
+        as is. Each byte of an invalid or incomplete sequence is escaped; the continuation bytes of an incomplete
+        sequence are escaped in turn, as they can't start a sequence.
+    */
+    inline size_t escape_special(const char* str, size_t pos, size_t size, char*& out) {
+        const unsigned char* seq = (const unsigned char*)str + pos;
+        const unsigned char val = seq[0];
+        if(val >= 0xC0) {
+            size_t expected = val < 0xE0 ? 1 : val < 0xF0 ? 2 : val < 0xF8 ? 3 : 0;
+            if(expected && expected < size - pos) {
+                size_t i = 1;
+                while(i <= expected && (seq[i] & 0xC0) == 0x80)
+                    i++;
+                if(i > expected) {
+                    std::memcpy(out, seq, expected + 1);
+                    out += expected + 1;
+                    return pos + expected + 1;
+                }
+            }
         }
+        write_replacee(out, val);
+        out += 6;
+        return pos + 1;
+    }
+
+    // Bit masks of the classes of the bytes of a vector
+    struct Classes {
+        uint64_t special; // is_special
+        uint64_t ascii_special; // Control characters, quotes and backslashes
+        uint64_t continuation; // 10xxxxxx
+        uint64_t lead2, lead3, lead4; // At least 110xxxxx, 1110xxxx or 11110xxx
+        uint64_t invalid; // 11111xxx
+    };
+
+    /*
+        Number of bytes from the start of a vector that can be copied as is. The vector starts at the start of a
+        character. A byte is an error if it's an ASCII special byte, if a continuation byte is expected after a lead
+        and it isn't one, or if it's a continuation byte where none is expected. A character cut by an error or by
+        the end of the vector is left out.
+    */
+    inline size_t plain_prefix(const Classes& c, size_t width) {
+        uint64_t expected = (c.lead2 << 1) | (c.lead3 << 2) | (c.lead4 << 3);
+        uint64_t error = ((c.continuation ^ expected) & ((1ull << width) - 1)) | c.invalid | c.ascii_special;
+        size_t first = error ? lowest_bit(error) : width;
+        if((expected >> first) & 1)
+            return highest_bit(~c.continuation & ((1ull << first) - 1));
+        return first;
     }
 
-    std::stack<size_t> positions;
-    for(size_t pos = 0; pos < str.length(); pos++) {
-        const unsigned char val = str[pos];
-        if(val < 0x20 || val == '\\' || val == '\"') {
-            positions.push(pos);
-            continue;
-        } else if(!(val & 0b10000000)) {
-            continue;
+    struct Scalar {
+        static constexpr size_t width = 1;
+    };
+
+#if defined(GCHECK_ESCAPE_SSE2)
+    // As signed bytes the non-ASCII bytes are negative, so the classes are ranges of signed comparisons
+    struct Sse2 {
+        static constexpr size_t width = 16;
+
+        static uint64_t Special(const char* str) {
+            __m128i v = _mm_loadu_si128((const __m128i*)str);
+            __m128i special = _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x20)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+            return (unsigned)_mm_movemask_epi8(special);
+        }
+        static Classes Classify(const char* str) {
+            __m128i v = _mm_loadu_si128((const __m128i*)str);
+            __m128i quotes = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+            __m128i below_space = _mm_cmplt_epi8(v, _mm_set1_epi8(0x20));
+            __m128i control = _mm_and_si128(below_space, _mm_cmpgt_epi8(v, _mm_set1_epi8(-1)));
+            uint64_t non_ascii = (unsigned)_mm_movemask_epi8(v);
+
+            Classes c;
+            c.special = (unsigned)_mm_movemask_epi8(_mm_or_si128(below_space, quotes));
+            c.ascii_special = (unsigned)_mm_movemask_epi8(_mm_or_si128(control, quotes));
+            c.continuation = (unsigned)_mm_movemask_epi8(_mm_cmplt_epi8(v, _mm_set1_epi8(-64)));
+            c.lead2 = (unsigned)_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65))) & non_ascii;
+            c.lead3 = (unsigned)_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-33))) & non_ascii;
+            c.lead4 = (unsigned)_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-17))) & non_ascii;
+            c.invalid = (unsigned)_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-9))) & non_ascii;
+            return c;
         }
-        int expected = 0;
-        if(val >> 6 == 0b10) {
-            positions.push(pos);
-            continue;
-        } else if(val >> 5 == 0b110) {
-            expected = 1;
-        } else if(val >> 4 == 0b1110) {
-            expected = 2;
-        } else if(val >> 3 == 0b11110) {
-            expected = 3;
-        } else {
-            positions.push(pos);
-            continue;
+        static void Copy(char* out, const char* str) {
+            _mm_storeu_si128((__m128i*)out, _mm_loadu_si128((const __m128i*)str));
         }
+    };
+#endif
+
+#if defined(GCHECK_ESCAPE_AVX2)
+    struct Avx2 {
+        static constexpr size_t width = 32;
 
-        int count = 0;
-        for(; count < expected; count++) {
-            if((unsigned char)str[pos+count+1] >> 6 != 0b10)
-                break;
+        __attribute__((target("avx2")))
+        static uint64_t Special(const char* str) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)str);
+            __m256i special = _mm256_or_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), v),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))));
+            return (unsigned)_mm256_movemask_epi8(special);
         }
+        __attribute__((target("avx2")))
+        static Classes Classify(const char* str) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)str);
+            __m256i quotes = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+            __m256i below_space = _mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), v);
+            __m256i control = _mm256_and_si256(below_space, _mm256_cmpgt_epi8(v, _mm256_set1_epi8(-1)));
+            uint64_t non_ascii = (unsigned)_mm256_movemask_epi8(v);
 
-        if(count != expected) {
-            for(int i = 0; i <= count; i++) {
-                positions.push(pos+i);
-            }
+            Classes c;
+            c.special = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(below_space, quotes));
+            c.ascii_special = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(control, quotes));
+            c.continuation = (unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(-64), v));
+            c.lead2 = (unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-65))) & non_ascii;
+            c.lead3 = (unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-33))) & non_ascii;
+            c.lead4 = (unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-17))) & non_ascii;
+            c.invalid = (unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-9))) & non_ascii;
+            return c;
         }
-        pos += count;
-    }
+        __attribute__((target("avx2")))
+        static void Copy(char* out, const char* str) {
+            _mm256_storeu_si256((__m256i*)out, _mm256_loadu_si256((const __m256i*)str));
+        }
+    };
+#endif
+
+    /*
+        Escapes 'str' to the end of 'out' in one forward pass. The input is processed in blocks, and the output is
+        sized for a block before writing it: each special byte grows by at most 5 bytes, and a UTF-8 sequence may
+        continue past the block. Vectors without special bytes are copied as is, and so are vectors of valid UTF-8.
+    */
+    template<typename V>
+    inline void escape(const char* str, size_t size, std::string& out) {
+        const size_t block = 4096;
+        size_t written = out.size();
+        size_t pos = 0;
+        while(pos < size) {
+            size_t end = std::min(size, pos + block);
 
-    str.resize(str.length()+positions.size()*5); // add space for encoding
+            size_t specials = 0;
+            size_t i = pos;
+            if constexpr(V::width > 1)
+                for(; i + V::width <= end; i += V::width)
+                    specials += bit_count(V::Special(str + i));
+            for(; i < end; i++)
+                specials += is_special(str[i]);
 
-    // escape non-utf-8 characters
-    size_t epos = str.length()-1;
-    size_t offset = positions.size()*5;
-    char* cstr = str.data();
-    while(!positions.empty()) {
-        size_t pos = positions.top();
-        auto repl = Replacee(str[pos]);
+            // Vector stores may write a whole vector past the end of the output
+            size_t needed = written + (end - pos) + 5*specials + 3 + V::width;
+            if(needed > out.size())
+                out.resize(needed + (size - end));
+            char* dst = out.data() + written;
 
-        std::memmove(cstr+offset+pos+1, cstr+pos+1, epos-offset-pos);
-        offset -= 5;
-        std::copy(repl.data(), repl.data()+6, cstr+offset+pos);
-        epos = offset+pos-1;
+            if constexpr(V::width > 1) {
+                while(pos + V::width <= end) {
+                    Classes c = V::Classify(str + pos);
+                    V::Copy(dst, str + pos);
+                    if(!c.special) {
+                        pos += V::width;
+                        dst += V::width;
+                        continue;
+                    }
 
-        positions.pop();
+                    size_t plain = plain_prefix(c, V::width);
+                    pos += plain;
+                    dst += plain;
+                    if(plain == V::width)
+                        continue;
+                    // Special bytes tend to come in runs, they are handled one at a time up to the next plain byte
+                    do {
+                        pos = escape_special(str, pos, size, dst);
+                    } while(pos < end && is_special(str[pos]));
+                }
+            }
+            while(pos < end) {
+                if(is_special(str[pos]))
+                    pos = escape_special(str, pos, size, dst);
+                else
+                    *dst++ = str[pos++];
+            }
+            written = dst - out.data();
+        }
+        out.resize(written);
     }
 
-    return str;
+#if defined(GCHECK_ESCAPE_AVX2)
+    __attribute__((target("avx2"), flatten))
+    void escape_avx2(const char* str, size_t size, std::string& out) {
+        escape<Avx2>(str, size, out);
+    }
+#endif
+} // anonymous
+
+void JSONEscape(std::string_view str, std::string& out) {
+#if defined(GCHECK_ESCAPE_AVX2)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if(has_avx2)
+        return escape_avx2(str.data(), str.size(), out);
+#endif
+#if defined(GCHECK_ESCAPE_SSE2)
+    escape<Sse2>(str.data(), str.size(), out);
+#else
+    escape<Scalar>(str.data(), str.size(), out);
+#endif
+}
+
+std::string JSONEscape(std::string_view str) {
+    std::string out;
+    JSONEscape(str, out);
+    return out;
 }
 
 
@@ -0,0 +1,124 @@
+#include <string>
+#include <stack>
+#include <random>
+#include <cstring>
+
+#include <gcheck/gcheck.h>
+#include <gcheck/function_test.h>
+#include <gcheck/stringify.h>
+
+/*
+    Microbenchmark of gcheck::JSONEscape against its previous implementation, which collected the positions to
+    escape on a stack and moved the tail of the string for each of them. The escaping is tested in escape_test.
+*/
+
+namespace {
+
+std::string Replacee(unsigned char val) {
+    static const char* digits = "0123456789ABCDEF";
+    std::string replacee = "\\u0000";
+    replacee[4] = digits[val >> 4];
+    replacee[5] = digits[val & 0xf];
+    return replacee;
+}
+
+std::string ReferenceEscape(std::string str) {
+    std::stack<size_t> positions;
+    for(size_t pos = 0; pos < str.length(); pos++) {
+        const unsigned char val = str[pos];
+        if(val < 0x20 || val == '\\' || val == '\"') {
+            positions.push(pos);
+            continue;
+        } else if(!(val & 0b10000000)) {
+            continue;
+        }
+        int expected = 0;
+        if(val >> 6 == 0b10) {
+            positions.push(pos);
+            continue;
+        } else if(val >> 5 == 0b110) {
+            expected = 1;
+        } else if(val >> 4 == 0b1110) {
+            expected = 2;
+        } else if(val >> 3 == 0b11110) {
+            expected = 3;
+        } else {
+            positions.push(pos);
+            continue;
+        }
+
+        int count = 0;
+        for(; count < expected; count++) {
+            if((unsigned char)str[pos+count+1] >> 6 != 0b10)
+                break;
+        }
+
+        if(count != expected) {
+            for(int i = 0; i <= count; i++) {
+                positions.push(pos+i);
+            }
+        }
+        pos += count;
+    }
+
+    str.resize(str.length()+positions.size()*5);
+
+    size_t epos = str.length()-1;
+    size_t offset = positions.size()*5;
+    char* cstr = str.data();
+    while(!positions.empty()) {
+        size_t pos = positions.top();
+        auto repl = Replacee(str[pos]);
+
+        std::memmove(cstr+offset+pos+1, cstr+pos+1, epos-offset-pos);
+        offset -= 5;
+        std::copy(repl.data(), repl.data()+6, cstr+offset+pos);
+        epos = offset+pos-1;
+
+        positions.pop();
+    }
+
+    return str;
+}
+
+enum Kind { Text, Unicode, Binary };
+
+// 1 MiB of prose, of mostly multibyte UTF-8 and of random bytes
+const std::string& Input(int kind) {
+    static std::string inputs[3];
+    std::string& input = inputs[kind];
+    if(!input.empty())
+        return input;
+
+    std::mt19937 rng(kind);
+    const size_t size = 1 << 20;
+    while(input.size() < size) {
+        switch(kind) {
+        case Text:
+            input += "The quick brown fox jumps over the \"lazy\" dog.\n";
+            break;
+        case Unicode:
+            input += "Hyvää päivää, 世界! ";
+            break;
+        default:
+            input += (char)rng();
+            break;
+        }
+    }
+    input.resize(size);
+    return input;
+}
+
+size_t EscapeReference(int kind) { return ReferenceEscape(Input(kind)).size(); }
+size_t EscapeVectorized(int kind) { return gcheck::JSONEscape(Input(kind)).size(); }
+
+} // anonymous
+
+FUNCTIONTEST(reference, Escape, 3, EscapeReference, 1) {
+    SetArguments((int)GetRunIndex());
+    SetBenchmark();
+}
+FUNCTIONTEST(vectorized, Escape, 3, EscapeVectorized, 1) {
+    SetArguments((int)GetRunIndex());
+    SetBenchmark();
+}
@@ -0,0 +1,143 @@
+#include <string>
+#include <random>
+
+#include <gcheck/gcheck.h>
+#include <gcheck/customtest.h>
+#include <gcheck/stringify.h>
+
+/*
+    Tests of gcheck::JSONEscape. The special bytes, the bytes of broken UTF-8 sequences and the bytes that can't
+    start a sequence are escaped as \u00XX, valid sequences are kept. The escaping works on blocks of 4096 bytes and
+    on vectors of 16 or 32 bytes, so the sequences are cut at those boundaries too.
+*/
+
+namespace {
+
+std::string Replacee(unsigned char val) {
+    static const char* digits = "0123456789ABCDEF";
+    std::string replacee = "\\u0000";
+    replacee[4] = digits[val >> 4];
+    replacee[5] = digits[val & 0xf];
+    return replacee;
+}
+
+// Escapes one byte at a time
+std::string ReferenceEscape(const std::string& str) {
+    std::string out;
+    for(size_t pos = 0; pos < str.length(); pos++) {
+        const unsigned char val = str[pos];
+        if(val < 0x20 || val == '\\' || val == '\"') {
+            out += Replacee(val);
+            continue;
+        } else if(val < 0x80) {
+            out += (char)val;
+            continue;
+        }
+
+        size_t expected;
+        if(val >> 5 == 0b110)
+            expected = 1;
+        else if(val >> 4 == 0b1110)
+            expected = 2;
+        else if(val >> 3 == 0b11110)
+            expected = 3;
+        else {
+            // A continuation byte without a lead or a byte that can't start a sequence
+            out += Replacee(val);
+            continue;
+        }
+
+        size_t count = 0;
+        while(count < expected && pos+count+1 < str.length() && (unsigned char)str[pos+count+1] >> 6 == 0b10)
+            count++;
+
+        if(count == expected) {
+            out.append(str, pos, count+1);
+        } else {
+            for(size_t i = 0; i <= count; i++)
+                out += Replacee(str[pos+i]);
+        }
+        pos += count;
+    }
+    return out;
+}
+
+// Offsets where the blocks and the vectors of the escaping end
+const size_t boundaries[] = { 15, 16, 31, 32, 63, 64, 4095, 4096, 4097, 8192 };
+const std::string sequences[] = { "\xC3\xA4", "\xE4\xB8\x96", "\xF0\x9F\x98\x80" };
+
+} // anonymous
+
+TEST(escape, Specials, 1) {
+    EXPECT_EQ(gcheck::JSONEscape("plain text"), "plain text");
+    EXPECT_EQ(gcheck::JSONEscape("\"quoted\"\\"), "\\u0022quoted\\u0022\\u005C");
+    EXPECT_EQ(gcheck::JSONEscape(std::string("\n\t\x01\x1F\0", 5)), "\\u000A\\u0009\\u0001\\u001F\\u0000");
+    EXPECT_EQ(gcheck::JSONEscape("H\xC3\xA4n \xE4\xB8\x96 \xF0\x9F\x98\x80"), "H\xC3\xA4n \xE4\xB8\x96 \xF0\x9F\x98\x80");
+}
+
+TEST(escape, LoneContinuationBytes, 1) {
+    EXPECT_EQ(gcheck::JSONEscape("\x80"), "\\u0080");
+    EXPECT_EQ(gcheck::JSONEscape("a\xBF" "b"), "a\\u00BFb");
+    EXPECT_EQ(gcheck::JSONEscape("\xC3\xA4\xA4"), "\xC3\xA4\\u00A4");
+    EXPECT_EQ(gcheck::JSONEscape("\xFF\xF8"), "\\u00FF\\u00F8");
+
+    // Alone at each boundary
+    int mismatches = 0;
+    for(size_t boundary : boundaries) {
+        for(size_t offset = boundary - 1; offset <= boundary; offset++) {
+            std::string str(offset, 'a');
+            str += "\x80" "b";
+            str += std::string(40, 'c');
+            if(gcheck::JSONEscape(str) != ReferenceEscape(str))
+                mismatches++;
+        }
+    }
+    EXPECT_EQ(mismatches, 0);
+}
+
+TEST(escape, SequencesAtBoundaries, 1) {
+    // Each sequence whole and cut short at each position, starting so that it crosses each boundary, and followed
+    // by more text or ending the string
+    int mismatches = 0;
+    int complete_changed = 0;
+    for(size_t boundary : boundaries) {
+        for(const std::string& sequence : sequences) {
+            for(size_t start = boundary - sequence.size(); start <= boundary; start++) {
+                for(size_t length = 1; length <= sequence.size(); length++) {
+                    for(const char* after : { "", "b", "\xC3\xA4", "\x80" }) {
+                        std::string str(start, 'a');
+                        str += sequence.substr(0, length);
+                        str += after;
+                        std::string escaped = gcheck::JSONEscape(str);
+                        if(escaped != ReferenceEscape(str))
+                            mismatches++;
+                        if(length == sequence.size() && after[0] != '\x80' && escaped != str)
+                            complete_changed++;
+                    }
+                }
+            }
+        }
+    }
+    EXPECT_EQ(mismatches, 0);
+    EXPECT_EQ(complete_changed, 0);
+
+    // Truncated at the end of the string
+    EXPECT_EQ(gcheck::JSONEscape("a\xE4\xB8"), "a\\u00E4\\u00B8");
+    EXPECT_EQ(gcheck::JSONEscape(std::string(4095, 'a') + "\xF0\x9F\x98"), std::string(4095, 'a') + "\\u00F0\\u009F\\u0098");
+}
+
+TEST(escape, Random, 1) {
+    // Short strings hit the scalar tails, the longer ones cross blocks
+    std::mt19937 rng(0);
+    const char alphabet[] = { 'a', '"', '\\', '\n', (char)0x80, (char)0xBF, (char)0xC3, (char)0xA4, (char)0xE4, (char)0xF0, (char)0xFF };
+    int mismatches = 0;
+    for(int i = 0; i < 10000; i++) {
+        size_t length = i % 100 == 0 ? 4000 + rng() % 5000 : rng() % 70;
+        std::string str(length, ' ');
+        for(char& c : str)
+            c = alphabet[rng() % sizeof(alphabet)];
+        if(gcheck::JSONEscape(str) != ReferenceEscape(str))
+            mismatches++;
+    }
+    EXPECT_EQ(mismatches, 0);
+}
@@ -0,0 +1,37 @@
+#!/usr/bin/env python3
+
+import sys
+import os
+sys.path.insert(1, os.path.join(sys.path[0], '..'))
+sys.path.insert(1, os.path.join(sys.path[0], '../../tools'))
+
+from utils import run, compare
+from report_parser import Report, Type
+
+process = run("escape_test")
+report = Report("report.json")
+
+expect = {
+    "escape.Specials": {
+        "points": 1,
+        "max_points": 1,
+        "num_results": 4,
+    },
+    "escape.LoneContinuationBytes": {
+        "points": 1,
+        "max_points": 1,
+        "num_results": 5,
+    },
+    "escape.SequencesAtBoundaries": {
+        "points": 1,
+        "max_points": 1,
+        "num_results": 4,
+    },
+    "escape.Random": {
+        "points": 1,
+        "max_points": 1,
+        "num_results": 1,
+    },
+}
+
+compare(report, expect)
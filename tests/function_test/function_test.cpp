@@ -1,5 +1,11 @@
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <cmath>
+
 #include <gcheck/gcheck.h>
 #include <gcheck/function_test.h>
+#include <gcheck/customtest.h>
 
 void VoidAndEmpty() {
 
@@ -59,4 +65,150 @@ FUNCTIONTEST(values, VoidAndIntInt2_fail, 3, VoidAndIntInt2, 4) {
 FUNCTIONTEST(values, IntAndIntInt2_fail, 3, IntAndIntInt2, 4) {
     SetArguments(2, (int)GetRunIndex());
     SetReturn(GetRunIndex());
-}
\ No newline at end of file
+}
+FUNCTIONTEST(benchmark, IntAndIntInt, 3, IntAndIntInt2, 3) {
+    SetArguments(2, (int)GetRunIndex()-1);
+    SetReturn(GetRunIndex());
+    SetMaxRunTime(std::chrono::seconds(1));
+    SetBenchmark();
+}
+
+int SortFast(std::vector<int> values) {
+    std::sort(values.begin(), values.end());
+    return values.front();
+}
+int SortSlow(std::vector<int> values) {
+    for(size_t i = 1; i < values.size(); i++)
+        for(size_t j = i; j > 0 && values[j-1] > values[j]; j--)
+            std::swap(values[j-1], values[j]);
+    return values.front();
+}
+
+FUNCTIONTEST(complexity, SortFast, 6, SortFast, 2) {
+    static auto values = gcheck::SequenceSizeContainer(gcheck::SizeLadder(4000, 128000, 6), 0, 1000000);
+    SetArguments(values.Next());
+    SetComplexity(gcheck::ONLogN);
+    SetBenchmark();
+}
+FUNCTIONTEST(complexity, SortSlow_fail, 6, SortSlow, 2) {
+    static auto values = gcheck::SequenceSizeContainer(gcheck::SizeLadder(250, 4000, 6), 0, 1000000);
+    SetArguments(values.Next());
+    SetComplexity(gcheck::ONLogN);
+    SetBenchmark();
+    SetGradingMethod(gcheck::AllOrNothing);
+}
+FUNCTIONTEST(perf, IntAndIntInt, 3, IntAndIntInt2, 3) {
+    SetArguments(2, (int)GetRunIndex()-1);
+    SetReturn(GetRunIndex());
+    SetMaxInstructions(1000000000);
+}
+
+int Allocate(int n) {
+    std::vector<std::unique_ptr<int>> values;
+    for(int i = 0; i < n; i++)
+        values.push_back(std::make_unique<int>(i));
+    return values.size();
+}
+
+FUNCTIONTEST(allocations, Allocate, 3, Allocate, 3) {
+    SetArguments(10);
+    SetReturn(10);
+    SetMaxAllocations(100);
+    SetMaxPeakBytes(4096);
+}
+FUNCTIONTEST(allocations, Allocate_fail, 3, Allocate, 3) {
+    SetArguments(1000);
+    SetReturn(1000);
+    SetMaxAllocations(100);
+}
+
+int Add(int a, int b) {
+    return a + b;
+}
+
+// The arguments are the same in each run with the same --seed, see test.py
+FUNCTIONTEST(random, Add, 5, Add, 2) {
+    gcheck::Random<int> a(-1000, 1000), b(-1000, 1000);
+    int x = a.Next(), y = b.Next();
+    SetArguments(x, y);
+    SetReturn(x + y);
+}
+
+template<typename T>
+std::vector<T> OneByOne(gcheck::NextType<T>& next, size_t count) {
+    std::vector<T> values;
+    for(size_t i = 0; i < count; i++)
+        values.push_back(next.Next());
+    return values;
+}
+
+// Values generated in bulk are the same as the ones taken one at a time, see test.py for the seeds
+TEST(random, Bulk, 1) {
+    // More than one batch of the distributions
+    const size_t count = 1000;
+    gcheck::Random<int> ints(-1000, 1000);
+    gcheck::Random<int64_t> full(INT64_MIN, INT64_MAX);
+    gcheck::Random<double> doubles(-1.0, 1.0);
+    // The container shares the stream of 'ints'
+    gcheck::Container<int> container(count);
+    container << ints;
+
+    // Starting the run again starts the streams from the beginning
+    auto restart = []() { gcheck::SetRandomRun("random", "Bulk", 0); };
+
+    restart();
+    auto expected_ints = OneByOne(ints, count);
+    auto expected_full = OneByOne(full, count);
+    auto expected_doubles = OneByOne(doubles, count);
+
+    restart();
+    EXPECT_TRUE(ints.NextBatch(count) == expected_ints);
+    EXPECT_TRUE(full.NextBatch(count) == expected_full);
+    EXPECT_TRUE(doubles.NextBatch(count) == expected_doubles);
+
+    restart();
+    std::vector<int> filled(count);
+    ints.Fill(filled.data(), 300);
+    ints.Fill(filled.data() + 300, count - 300);
+    EXPECT_TRUE(filled == expected_ints);
+    EXPECT_EQ(ints(), expected_ints.back());
+
+    restart();
+    EXPECT_TRUE(container.Next() == expected_ints);
+}
+
+// A part of a Combine that returns its id and how many values were taken from it before, as taken*parts + id
+struct CountingPart : public gcheck::Discrete<int> {
+    CountingPart(int id, size_t choices) : id(id), choices(choices) {}
+
+    int& Next() { value = taken++*3 + id; return value; }
+    CountingPart* Clone() const { return new CountingPart(*this); }
+    size_t ChoiceLength() { return choices; }
+
+    int id;
+    size_t choices;
+    int taken = 0;
+    int value = 0;
+};
+
+// The parts are chosen in proportion to their numbers of choices and only the chosen part gives a value
+TEST(random, Combine, 1) {
+    gcheck::Combine<gcheck::DiscreteCombine, CountingPart, CountingPart, CountingPart> combine(CountingPart(0, 1), CountingPart(1, 3), CountingPart(2, 6));
+    EXPECT_EQ(combine.ChoiceLength(), (size_t)10);
+
+    const int draws = 100000;
+    int counts[3] = {};
+    bool only_chosen = true;
+    for(int i = 0; i < draws; i++) {
+        int value = combine.Next();
+        int part = value % 3;
+        if(value / 3 != counts[part])
+            only_chosen = false;
+        counts[part]++;
+    }
+    EXPECT_TRUE(only_chosen);
+
+    const double shares[3] = {0.1, 0.3, 0.6};
+    for(int part = 0; part < 3; part++)
+        EXPECT_TRUE(std::abs(counts[part]/double(draws) - shares[part]) < 0.01) << "part " << part << ": " << counts[part] << " of " << draws;
+}
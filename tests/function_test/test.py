@@ -84,6 +84,141 @@ expect = {
             "num_cases": 3,
         }],
     },
+    "benchmark.IntAndIntInt": {
+        "points": 3,
+        "max_points": 3,
+        "results": [{
+            "type": Type.FC,
+            "num_cases": 3,
+        }],
+    },
+    "perf.IntAndIntInt": {
+        "points": 3,
+        "max_points": 3,
+        "results": [{
+            "type": Type.FC,
+            "num_cases": 3,
+        }],
+    },
+    "allocations.Allocate": {
+        "points": 3,
+        "max_points": 3,
+        "results": [{
+            "type": Type.FC,
+            "num_cases": 3,
+        }],
+    },
+    "allocations.Allocate_fail": {
+        "points": 0,
+        "max_points": 3,
+        "results": [{
+            "type": Type.FC,
+            "num_cases": 3,
+        }],
+    },
+    "random.Add": {
+        "points": 2,
+        "max_points": 2,
+        "results": [{
+            "type": Type.FC,
+            "num_cases": 5,
+        }],
+    },
+    "random.Bulk": {
+        "points": 1,
+        "max_points": 1,
+        "num_results": 6,
+    },
+    "random.Combine": {
+        "points": 1,
+        "max_points": 1,
+        "num_results": 5,
+    },
+    "complexity.SortFast": {
+        "points": 2,
+        "max_points": 2,
+        "results": [{
+            "type": Type.FC,
+            "num_cases": 6,
+        }, {
+            "type": Type.CX,
+        }],
+    },
+    "complexity.SortSlow_fail": {
+        "points": 0,
+        "max_points": 2,
+        "results": [{
+            "type": Type.FC,
+            "num_cases": 6,
+        }, {
+            "type": Type.CX,
+        }],
+    },
 }
 
 compare(report, expect)
+
+# Every case of a benchmark has the statistics of its run times
+def check_benchmark(report):
+    test = next(test for test in report.tests if test.suite == "benchmark" and test.test == "IntAndIntInt")
+    for case in test.results[0].cases:
+        stats = case.run_time_stats
+        if stats is None:
+            raise Exception("No run time statistics for benchmark.IntAndIntInt")
+        if stats["samples"] <= 0:
+            raise Exception("No run time samples for benchmark.IntAndIntInt")
+        if stats["statistic"] != "median":
+            raise Exception("Benchmark statistic is " + str(stats["statistic"]) + ", not median")
+        if not stats["minimum"] <= stats["median"] <= stats["percentile90"] <= stats["percentile99"] <= stats["maximum"]:
+            raise Exception("Run time percentiles out of order: " + str(stats))
+        if not 0 <= stats["mad"] <= stats["maximum"] - stats["minimum"]:
+            raise Exception("Run time MAD out of range: " + str(stats))
+
+check_benchmark(report)
+
+process = run("function_test", "--jobs", "4")
+report = Report("report.json")
+
+compare(report, expect)
+
+process = run("function_test", "--fork-server")
+report = Report("report.json")
+
+compare(report, expect)
+
+process = run("function_test", "--binary")
+report = Report("report.msgpack")
+
+compare(report, expect)
+check_benchmark(report)
+
+# The random arguments depend only on the seed, not on how the tests are run
+def random_arguments(report):
+    test = next(test for test in report.tests if test.suite == "random" and test.test == "Add")
+    return [case.arguments.json for case in test.results[0].cases]
+
+process = run("function_test", "--seed", "1234")
+report = Report("report.json")
+arguments = random_arguments(report)
+if report.seed != 1234:
+    raise Exception("Seed not saved")
+if len(set(map(str, arguments))) == 1:
+    raise Exception("Random arguments don't vary between runs")
+
+def check_bulk(report):
+    test = next(test for test in report.tests if test.suite == "random" and test.test == "Bulk")
+    if test.points != test.max_points:
+        raise Exception("Values generated in bulk differ from the ones taken one at a time with seed " + str(report.seed))
+
+check_bulk(report)
+
+for args in [["--safe"], ["--jobs", "4"], ["--safe-batch", "2"], ["--fork-server"]]:
+    process = run("function_test", "--seed", "1234", *args)
+    if random_arguments(Report("report.json")) != arguments:
+        raise Exception("Random arguments differ with " + " ".join(args))
+
+process = run("function_test", "--seed", "4321")
+report = Report("report.json")
+if random_arguments(report) == arguments:
+    raise Exception("Random arguments don't depend on the seed")
+check_bulk(report)
@@ -110,4 +110,63 @@ IOTEST(std, IntAndIntInt2AndWriteErrAndOut_fail, 3, IntAndIntInt2AndWriteErrAndO
     SetInput("asd", true);
     SetOutput("assd");
     SetError("asderr");
-}
\ No newline at end of file
+}
+
+void WriteLines(int n) {
+    for(int i = 0; i < n; i++)
+        std::cout << "line " << i << '\n';
+}
+std::string Lines(int n) {
+    std::string str;
+    for(int i = 0; i < n; i++)
+        str += "line " + std::to_string(i) + '\n';
+    return str;
+}
+
+IOTEST(stream, WriteLines, 3, WriteLines, 4) {
+    SetArguments(100000);
+    SetOutput(Lines(100000));
+}
+IOTEST(stream, WriteLines_fail, 3, WriteLines, 4) {
+    SetArguments(100000);
+    SetOutput(Lines(50000) + "line x\n" + Lines(100000).substr(Lines(50001).size()));
+}
+IOTEST(stream, WriteLinesLimit_fail, 3, WriteLines, 4) {
+    SetOutputLimit(1000);
+    SetArguments(100000);
+}
+
+// Writes n lines of one to four byte UTF-8 characters
+void WriteWide(int n) {
+    for(int i = 0; i < n; i++)
+        std::cout << "\u00E4\u20AC\U0001D11Ex\n";
+}
+
+// The output is several MiB, so the pretty output elides it, see test.py
+IOTEST(stream, WriteWide, 1, WriteWide, 4) {
+    SetArguments(400000);
+    std::string output;
+    for(int i = 0; i < 400000; i++)
+        output += "\u00E4\u20AC\U0001D11Ex\n";
+    SetOutput(output);
+}
+
+size_t CountInput() {
+    size_t count = 0;
+    char c;
+    while(std::cin.get(c))
+        count++;
+    return count;
+}
+
+IOTEST(stream, LargeInput, 3, CountInput, 4) {
+    SetInput(std::string(1 << 22, 'a'), true);
+    SetReturn(1 << 22);
+}
+IOTEST(stream, InputFile, 3, IntAndIntInt2AndWriteErrAndOut, 4) {
+    SetArguments("asd", (int)GetRunIndex()-1);
+    SetReturn(GetRunIndex());
+    SetInputFile("input.txt");
+    SetOutput("asd");
+    SetError("asderr");
+}